@@ -0,0 +1,290 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "SDL2/SDL.h"
+#include "audio.h"
+
+#define AUDIO_RATE          44100
+#define AUDIO_CHANNELS      2
+#define AUDIO_FRAMES        512 // Per callback, 11.6 ms
+#define SOUNDS              (SOUND_EXPLOSION + 1)
+#define VOICES              16  // Sounds playing at once
+#define QUEUE_SIZE          64  // Power of two
+#define MIX_FRAMES          1024 // Mixed in one go
+
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+struct sample
+{
+    Sint16 *data;         // AUDIO_CHANNELS interleaved, AUDIO_RATE
+    int frames;
+};
+
+struct voice
+{
+    const struct sample *sample; // NULL for a free voice
+    int pos;              // Next frame to play
+};
+
+/********************
+ * Global variables *
+ ********************/
+static SDL_AudioDeviceID Device;
+static struct sample Samples[SOUNDS];
+static const char *SampleFile[SOUNDS] = {NULL, "res/move.wav",
+    "res/diamond.wav", "res/explosion.wav"};
+
+// Game thread to audio thread: each side writes its own index only
+static Uint8 Queue[QUEUE_SIZE];
+static SDL_atomic_t QueueHead, QueueTail;
+static long Dropped;      // Sounds the queue had no room for
+
+// Audio thread only
+static struct voice Voices[VOICES];
+static Sint32 Mix[MIX_FRAMES * AUDIO_CHANNELS];
+static Uint64 MixTime, MixMax, LastCallback;
+static long Callbacks, Late;
+
+
+/****************************************************************
+ * Samples: res/<name>.wav converted to the mixer's format, or, *
+ * without the file, a simple sound made here                  *
+ ****************************************************************/
+static void SampleNew(struct sample *sample, int frames)
+{
+    sample->frames = frames;
+    sample->data = calloc(frames * AUDIO_CHANNELS, sizeof(Sint16));
+    if (!sample->data)
+        exit(fprintf(stderr, "Out of memory\n"));
+}
+
+static int SampleLoad(struct sample *sample, const char *path)
+{
+    SDL_AudioSpec spec;
+    SDL_AudioCVT cvt;
+    Uint8 *data;
+    Uint32 size;
+
+    if (!SDL_LoadWAV(path, &spec, &data, &size))
+        return -1;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+        AUDIO_S16SYS, AUDIO_CHANNELS, AUDIO_RATE) < 0)
+    {
+        SDL_FreeWAV(data);
+        return -1;
+    }
+
+    cvt.len = cvt.len_cvt = size;
+    if (!(cvt.buf = malloc(size * cvt.len_mult)))
+        exit(fprintf(stderr, "Out of memory\n"));
+    memcpy(cvt.buf, data, size);
+    SDL_FreeWAV(data);
+    if (cvt.needed && SDL_ConvertAudio(&cvt) < 0)
+    {
+        free(cvt.buf);
+        return -1;
+    }
+
+    sample->data = (Sint16 *)cvt.buf;
+    sample->frames = cvt.len_cvt / (AUDIO_CHANNELS * sizeof(Sint16));
+    return 0;
+}
+
+static void SampleMake(struct sample *sample, enum sound sound)
+{
+    double t, v = 0, low = 0;
+    Uint32 noise = 1;
+    int i, c;
+
+    switch (sound)
+    {
+        case SOUND_MOVE:      SampleNew(sample, AUDIO_RATE / 40); break;
+        case SOUND_DIAMOND:   SampleNew(sample, AUDIO_RATE / 8); break;
+        case SOUND_EXPLOSION: SampleNew(sample, AUDIO_RATE * 2 / 5); break;
+        case SOUND_NONE:      return;
+    }
+
+    for (i = 0; i < sample->frames; i++)
+    {
+        t = (double)i / AUDIO_RATE;
+        noise = noise * 1664525 + 1013904223;
+        switch (sound)
+        {
+            case SOUND_MOVE: // A dull step
+                v = 0.15 * exp(-t * 150) * (fmod(t * 160, 1) < 0.5 ? 1 : -1);
+                break;
+            case SOUND_DIAMOND: // Two bells
+                v = 0.2 * exp(-t * 25) * (sin(2 * M_PI * 1320 * t)
+                    + 0.5 * sin(2 * M_PI * 1980 * t));
+                break;
+            case SOUND_EXPLOSION: // Low passed noise
+                low += ((noise >> 16) / 32768.0 - 1 - low) * 0.08;
+                v = 0.9 * exp(-t * 8) * low;
+                break;
+            case SOUND_NONE:
+                break;
+        }
+        for (c = 0; c < AUDIO_CHANNELS; c++)
+            sample->data[i * AUDIO_CHANNELS + c] = v * 32767;
+    }
+}
+
+
+/*********************************************
+ * Audio thread: new sounds from the queue, *
+ * then all the voices added up             *
+ *********************************************/
+static void StartVoice(enum sound sound)
+{
+    struct voice *v = &Voices[0];
+    int i;
+
+    // A free voice, or the one closest to its end
+    for (i = 0; i < VOICES; i++)
+    {
+        if (!Voices[i].sample)
+        {
+            v = &Voices[i];
+            break;
+        }
+        if (Voices[i].sample->frames - Voices[i].pos
+            < v->sample->frames - v->pos)
+            v = &Voices[i];
+    }
+    v->sample = &Samples[sound];
+    v->pos = 0;
+}
+
+static void MixFrames(Sint16 *out, int frames)
+{
+    struct voice *v;
+    int i, n, k;
+
+    for (i = 0; i < frames * AUDIO_CHANNELS; i++)
+        Mix[i] = 0;
+    for (v = Voices; v < Voices + VOICES; v++)
+    {
+        if (!v->sample)
+            continue;
+        n = v->sample->frames - v->pos < frames
+            ? v->sample->frames - v->pos : frames;
+        for (i = 0, k = v->pos * AUDIO_CHANNELS; i < n * AUDIO_CHANNELS;
+             i++, k++)
+            Mix[i] += v->sample->data[k];
+        if ((v->pos += n) == v->sample->frames)
+            v->sample = NULL;
+    }
+    for (i = 0; i < frames * AUDIO_CHANNELS; i++)
+        out[i] = Mix[i] > 32767 ? 32767 : Mix[i] < -32768 ? -32768 : Mix[i];
+}
+
+static void Callback(void *data, Uint8 *stream, int len)
+{
+    Uint64 start = SDL_GetPerformanceCounter(), spent;
+    Uint64 period = SDL_GetPerformanceFrequency() * AUDIO_FRAMES / AUDIO_RATE;
+    Sint16 *out = (Sint16 *)stream;
+    int frames = len / (AUDIO_CHANNELS * sizeof(Sint16)), n, tail, head;
+
+    (void)data;
+    // Later than two buffers after the last one: the device ran dry
+    if (LastCallback && start - LastCallback > 2 * period)
+        Late++;
+    LastCallback = start;
+
+    tail = SDL_AtomicGet(&QueueTail);
+    head = SDL_AtomicGet(&QueueHead);
+    for (; tail != head; tail++)
+        StartVoice(Queue[tail & (QUEUE_SIZE - 1)]);
+    SDL_AtomicSet(&QueueTail, tail);
+
+    for (; frames > 0; frames -= n, out += n * AUDIO_CHANNELS)
+    {
+        n = frames < MIX_FRAMES ? frames : MIX_FRAMES;
+        MixFrames(out, n);
+    }
+
+    spent = SDL_GetPerformanceCounter() - start;
+    MixTime += spent;
+    if (spent > MixMax)
+        MixMax = spent;
+    Callbacks++;
+}
+
+
+/******************************************************
+ * Game thread: a sound to start at the next callback *
+ ******************************************************/
+void AudioPlay(enum sound sound)
+{
+    int head = SDL_AtomicGet(&QueueHead);
+
+    if (!Device || sound <= SOUND_NONE || sound >= SOUNDS)
+        return;
+    if (head - SDL_AtomicGet(&QueueTail) == QUEUE_SIZE)
+    {
+        Dropped++;
+        return;
+    }
+    Queue[head & (QUEUE_SIZE - 1)] = sound;
+    SDL_AtomicSet(&QueueHead, head + 1); // Publishes the entry
+}
+
+
+/******************************************
+ * Samples ready, then the device started *
+ ******************************************/
+int AudioOpen(void)
+{
+    SDL_AudioSpec want = {0};
+    int sound;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+        return -1;
+    for (sound = SOUND_MOVE; sound < SOUNDS; sound++)
+        if (SampleLoad(&Samples[sound], SampleFile[sound]) < 0)
+            SampleMake(&Samples[sound], sound);
+
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = AUDIO_CHANNELS;
+    want.samples = AUDIO_FRAMES;
+    want.callback = Callback;
+    // Any other format is converted by SDL, the mixer stays as it is
+    Device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    if (!Device)
+    {
+        fprintf(stderr, "No sound: %s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_PauseAudioDevice(Device, 0);
+    return 0;
+}
+
+// Stops the device, then reports how the mixer did
+void AudioClose(void)
+{
+    double freq = SDL_GetPerformanceFrequency();
+    int sound;
+
+    if (!Device)
+        return;
+    SDL_CloseAudioDevice(Device);
+    Device = 0;
+
+    if (Callbacks)
+        printf("audio callbacks %ld mix_us avg %.1f max %.1f load %.2f%% "
+            "late %ld dropped %ld\n", Callbacks,
+            MixTime * 1e6 / freq / Callbacks, MixMax * 1e6 / freq,
+            100.0 * MixTime / freq / (Callbacks * AUDIO_FRAMES
+            / (double)AUDIO_RATE), Late, Dropped);
+    for (sound = SOUND_MOVE; sound < SOUNDS; sound++)
+        free(Samples[sound].data);
+}
@@ -0,0 +1,21 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "world.h"
+
+/*
+ * Sound for the SDL frontend. The samples are made ready at AudioOpen,
+ * the audio thread only mixes them: no allocation, no lock. AudioPlay
+ * is for one thread (the game's), it posts to a single producer, single
+ * consumer queue the audio callback empties.
+ */
+int AudioOpen(void);
+void AudioPlay(enum sound sound);
+void AudioClose(void);
+
+#endif
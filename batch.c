@@ -0,0 +1,431 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ *
+ * Batch runner: plays many independent games headless on all cores.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "world.h"
+#include "pool.h"
+#include "replay.h"
+#include "pack.h"
+#include "rules.h"
+#include "sweep.h"
+#include "history.h"
+#include "profile.h"
+#include "tools.h"
+
+#define MAX_TICKS           100000
+#define KEY_TICKS           6
+
+enum result {UNFINISHED, FINISHED, GAME_OVER, REPLAY_OK, REPLAY_BAD,
+             DIVERGED};
+
+struct job
+{
+    struct task task;
+    int level;
+    unsigned seed;        // Board and input random numbers
+    long ticks;           // Ticks simulated
+    enum result result;
+};
+
+/********************
+ * Global variables *
+ ********************/
+const char *Script;       // Scripted keys, NULL for random input
+struct replay *Replay;    // Recorded session to play back instead
+long MaxTicks = MAX_TICKS;
+int KeyTicks = KEY_TICKS;
+enum physics Physics = PHYSICS_SCALAR;
+int Differential;         // Two engines side by side, see PlayGame
+enum physics Other;       // The one beside the scalar engine
+struct pack Pack;
+
+
+/***********************************************
+ * Key from the script (README keys, '.' wait) *
+ ***********************************************/
+enum input ScriptInput(const char **p)
+{
+    while (**p == '\n' || **p == '\r' || **p == '\t')
+        (*p)++;
+
+    switch (*(*p)++)
+    {
+        case 'a': return INPUT_LEFT;
+        case 'd': return INPUT_RIGHT;
+        case 'w': return INPUT_UP;
+        case 's': return INPUT_DOWN;
+        case ' ': return INPUT_ACTION;
+        case 0:   (*p)--; return INPUT_NONE;
+    }
+
+    return INPUT_NONE;
+}
+
+
+/*****************
+ * Play one game *
+ *****************/
+void PlayGame(struct task *task, struct worker *worker)
+{
+    struct job *job = task->arg;
+    struct world world, other;
+    struct replay replay;
+    const char *script = Script;
+    unsigned keys = job->seed * 2654435761u;
+    enum input input;
+    int events;
+
+    if (Replay)
+    {
+        replay = *Replay; // Own playback position, shared records
+        job->result = ReplayRun(&replay, &world) ? REPLAY_BAD : REPLAY_OK;
+        job->ticks = world.tick;
+        WorldFree(&world);
+        return;
+    }
+
+    WorldStart(&world, job->level, job->seed);
+    world.physics = Physics;
+    if (Differential)
+    {
+        WorldStart(&other, job->level, job->seed);
+        world.physics = PHYSICS_SCALAR;
+        other.physics = Other;
+    }
+
+    while (job->ticks < MaxTicks)
+    {
+        input = INPUT_NONE;
+        if (job->ticks % KeyTicks == 0)
+            input = script ? ScriptInput(&script) : RandomInput(&keys);
+
+        events = WorldStep(&world, input);
+        job->ticks++;
+        // Only the physics can tell the engines apart
+        if (Differential && (WorldStep(&other, input) != events
+            || ((events & WORLD_PHYSICS)
+                && WorldChecksum(&other) != WorldChecksum(&world))))
+        {
+            job->result = DIVERGED;
+            break;
+        }
+        if (events & WORLD_GAME_OVER)
+        {
+            job->result = GAME_OVER;
+            break;
+        }
+        if (events & WORLD_LEVEL_DONE)
+        {
+            job->result = FINISHED;
+            break;
+        }
+    }
+
+    WorldFree(&world);
+    if (Differential)
+        WorldFree(&other);
+}
+
+
+/**********************************
+ * Count the levels found in res/ *
+ **********************************/
+int CountLevels(void)
+{
+    struct world world;
+    int n = 0;
+
+    if (LevelPack)
+        return LevelPack->count;
+
+    WorldInit(&world);
+    while (LoadLevel(&world, n) == 0)
+        n++;
+    WorldFree(&world);
+
+    return n;
+}
+
+
+/*****************************************************************
+ * Check the sweep kernels: random rows against plain C, and the *
+ * first tile of every kind on every level against a plain scan *
+ *****************************************************************/
+int CheckSweeps(int levels)
+{
+    struct world world;
+    int bad, level, v, j, i, y, x, found;
+
+    bad = SweepCheck(1000000);
+
+    WorldInit(&world);
+    for (level = 0; level < levels; level++)
+    {
+        LoadLevel(&world, level);
+        for (v = 0; v < 16; v++)
+        {
+            found = -1;
+            for (j = 1; found < 0 && j < world.height - 1; j++)
+                for (i = 1; found < 0 && i < world.width - 1; i++)
+                    if (GetBoard(&world, j, i) == v)
+                        found = j * world.width + i;
+
+            if (FindObject(&world, v, &y, &x) != (found < 0 ? -1 : v)
+                || (found >= 0 && found != y * world.width + x))
+                bad++;
+        }
+    }
+    WorldFree(&world);
+
+    printf("sweep %s levels %d mismatches %d\n", SweepName(), levels, bad);
+    return bad;
+}
+
+
+/*****************************************************************
+ * Check the incremental board hash against one made from scratch *
+ * on every level: loaded, while played, and after restarts      *
+ *****************************************************************/
+int CheckHashes(int levels)
+{
+    struct world world;
+    unsigned keys = 1;
+    int bad = 0, level;
+    long ticks = 0, t;
+
+    for (level = 0; level < levels; level++)
+    {
+        WorldStart(&world, level, level);
+        world.physics = Physics;
+        for (t = 0; t < MaxTicks; t++, ticks++)
+        {
+            bad += BoardHash(&world) != BoardHashFull(&world);
+            WorldStep(&world, t % 1000 == 999 ? INPUT_RESTART
+                : t % KeyTicks ? INPUT_NONE : RandomInput(&keys));
+        }
+        WorldFree(&world);
+    }
+
+    printf("hash levels %d ticks %ld mismatches %d\n", levels, ticks, bad);
+    return bad;
+}
+
+
+/******************************************************************
+ * Check the rewind: every so often go back a random number of    *
+ * ticks, the state must be the one seen at that tick, then play  *
+ * on from there with other keys. Restarts change the board too.  *
+ ******************************************************************/
+int CheckRewind(int levels)
+{
+    struct world world;
+    struct history history;
+    uint32_t *sums;
+    unsigned keys = 1;
+    int bad = 0, level, back;
+    long steps = 0, rewinds = 0, t;
+    size_t bytes, peak = 0;
+    double start, spent = 0;
+
+    if (!(sums = malloc(MaxTicks * sizeof(uint32_t))))
+        exit(fprintf(stderr, "Out of memory\n"));
+
+    for (level = 0; level < levels; level++)
+    {
+        WorldStart(&world, level, level);
+        world.physics = Physics;
+        HistoryInit(&history, HISTORY_TICKS);
+        HistoryPush(&history, &world);
+        sums[0] = WorldChecksum(&world);
+        for (t = 0; t < MaxTicks && world.tick < MaxTicks - 1; t++, steps++)
+        {
+            WorldStep(&world, world.tick % 1000 == 999 ? INPUT_RESTART
+                : t % KeyTicks ? INPUT_NONE : RandomInput(&keys));
+            HistoryPush(&history, &world);
+            sums[world.tick] = WorldChecksum(&world);
+
+            if (t % 500 == 499)
+            {
+                if ((bytes = HistoryBytes(&history)) > peak)
+                    peak = bytes;
+                start = Seconds();
+                back = HistoryRewind(&history, &world, (keys >> 16) % 2000);
+                spent += Seconds() - start;
+                bad += WorldChecksum(&world) != sums[world.tick];
+                rewinds += back > 0;
+            }
+        }
+        HistoryFree(&history);
+        WorldFree(&world);
+    }
+    free(sums);
+
+    printf("rewind levels %d ticks %ld rewinds %ld mismatches %d\n",
+        levels, steps, rewinds, bad);
+    printf("rewind history %d ticks peak %.2f MB, %.1f us per rewind\n",
+        HISTORY_TICKS, peak / 1048576.0, rewinds ? spent * 1e6 / rewinds : 0);
+    return bad;
+}
+
+
+/******************************
+ * Read the whole script file *
+ ******************************/
+char *ReadScript(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    char *buf;
+    long size;
+
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf = calloc(size + 1, 1);
+    if (buf && fread(buf, 1, size, fp) != (size_t)size)
+    {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    return buf;
+}
+
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: batch [-n games] [-j threads] [-l level] [-t max_ticks]\n"
+        "             [-k ticks_per_key] [-r seed] [-i script] [-L pack]\n"
+        "             [-b | -D | -A]  (bitboard engine, or compared with\n"
+        "             the scalar one: -D bitboard, -A the full scan)\n"
+        "       batch [-n games] [-j threads] -p replay\n"
+        "       batch -S    (check the sweep kernels)\n"
+        "       batch -H [-t ticks] [-b]  (check the board hash)\n"
+        "       batch -U [-t ticks] [-b]  (check the rewind)\n");
+    exit(1);
+}
+
+
+/********
+ * Main *
+ ********/
+int main(int argc, char **argv)
+{
+    int games = 1000, threads = 0, level = -1, levels, opt, i;
+    unsigned seed = 1;
+    long ticks = 0, finished = 0, over = 0, good = 0, diverged = 0;
+    struct job *jobs;
+    struct task **tasks;
+    struct pool_stats stats;
+    double start, elapsed;
+    const char *pack = NULL;
+    int check = 0;
+
+    while ((opt = getopt(argc, argv, "n:j:l:t:k:r:i:p:L:SHUbDA")) != -1)
+        switch (opt)
+        {
+            case 'n': games = atoi(optarg); break;
+            case 'j': threads = atoi(optarg); break;
+            case 'l': level = atoi(optarg) - 1; break;
+            case 't': MaxTicks = atol(optarg); break;
+            case 'k': KeyTicks = atoi(optarg); break;
+            case 'r': seed = strtoul(optarg, NULL, 0); break;
+            case 'i':
+                if (!(Script = ReadScript(optarg)))
+                    exit(fprintf(stderr, "Could not read %s\n", optarg));
+                break;
+            case 'p':
+                Replay = calloc(1, sizeof(struct replay));
+                if (!Replay || ReplayLoad(Replay, optarg) < 0)
+                    exit(fprintf(stderr, "Could not read %s\n", optarg));
+                break;
+            case 'L': pack = optarg; break;
+            case 'S': check = 1; break;
+            case 'H': check = 2; break;
+            case 'U': check = 3; break;
+            case 'b': Physics = PHYSICS_BITBOARD; break;
+            case 'D': Differential = 1; Other = PHYSICS_BITBOARD; break;
+            case 'A': Differential = 1; Other = PHYSICS_SCAN; break;
+            default: Usage();
+        }
+
+    // The tile rules, the built in ones when there is no file
+    if ((i = RulesLoad(RULES_FILE)) > 0)
+        exit(fprintf(stderr, "Bad rule in %s line %d\n", RULES_FILE, i));
+
+    // The level pack if there is one, the .lvl files otherwise
+    if ((pack ? PackOpen(&Pack, pack) : PackOpenDefault(&Pack)) == 0)
+        LevelPack = &Pack;
+    else
+    if (pack)
+        exit(fprintf(stderr, "Could not read %s\n", pack));
+
+#ifdef PROFILE
+    atexit(ProfileExit);
+#endif
+    levels = CountLevels();
+    if (check == 1)
+        return CheckSweeps(levels) ? 1 : 0;
+    if (check == 2)
+        return CheckHashes(levels) ? 1 : 0;
+    if (check == 3)
+        return CheckRewind(levels) ? 1 : 0;
+    if (games < 1 || KeyTicks < 1 || !levels)
+        Usage();
+    if (threads < 1)
+        threads = PoolThreads();
+
+    jobs = calloc(games, sizeof(struct job));
+    tasks = calloc(games, sizeof(struct task *));
+    if (!jobs || !tasks)
+        exit(fprintf(stderr, "Out of memory\n"));
+
+    for (i = 0; i < games; i++)
+    {
+        jobs[i].task.run = PlayGame;
+        jobs[i].task.arg = &jobs[i];
+        jobs[i].level = level < 0 ? i % levels : level;
+        jobs[i].seed = seed + i;
+        tasks[i] = &jobs[i].task;
+    }
+
+    start = Seconds();
+    PoolRun(tasks, games, threads, &stats);
+    elapsed = Seconds() - start;
+
+    for (i = 0; i < games; i++)
+    {
+        ticks += jobs[i].ticks;
+        finished += jobs[i].result == FINISHED;
+        over += jobs[i].result == GAME_OVER;
+        good += jobs[i].result == REPLAY_OK;
+        diverged += jobs[i].result == DIVERGED;
+    }
+
+    printf("games %d threads %d ticks %ld seconds %.3f ticks/s %.0f\n",
+        games, threads, ticks, elapsed, ticks / elapsed);
+    if (Replay)
+        printf("replays %d identical %ld diverged %ld steals %ld\n",
+            games, good, games - good, stats.steals);
+    else
+        printf("finished %ld game_over %ld unfinished %ld steals %ld\n",
+            finished, over, games - finished - over, stats.steals);
+    if (Differential)
+        printf("engines scalar %s identical %ld diverged %ld\n",
+            Other == PHYSICS_SCAN ? "scan" : "bitboard",
+            games - diverged, diverged);
+
+    free(tasks);
+    free(jobs);
+    // As -S, -H and -U: 1 when a replay or the other engine went its own way
+    return (Replay && good < games) || diverged ? 1 : 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ *
+ * Benchmarks of the game core over every shipped level, one line each:
+ *   benchmark  ops  ns_per_op  ops_per_s  allocs_per_op
+ * tab separated, so runs of two releases can be compared with a script.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "world.h"
+#include "pack.h"
+#include "rules.h"
+#include "sweep.h"
+#include "bitboard.h"
+#include "canvas.h"
+#include "tools.h"
+
+#define MIN_SECONDS         0.5
+#define ROUND_CALLS         32  // Calls timed after each fresh board
+#define STEP_TICKS          2000
+#define KEY_TICKS           6
+
+struct result
+{
+    long ops;
+    double seconds;       // Timed parts only
+    long allocs;
+};
+
+/********************
+ * Global variables *
+ ********************/
+int Levels;
+double MinSeconds = MIN_SECONDS;
+struct pack Pack;
+long Allocs;              // malloc, calloc and realloc calls so far
+double Begin;
+long BeginAllocs;
+
+
+/*****************************************************************
+ * Allocation count: built with -DCOUNT_ALLOCS and linked with   *
+ * --wrap for the three, every call in the core goes through here *
+ *****************************************************************/
+#ifdef COUNT_ALLOCS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    Allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    Allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    Allocs++;
+    return __real_realloc(p, size);
+}
+#endif
+
+
+// Only the time between Start and Stop counts
+void Start(void)
+{
+    BeginAllocs = Allocs;
+    Begin = Seconds();
+}
+
+void Stop(struct result *r, long ops)
+{
+    r->seconds += Seconds() - Begin;
+    r->allocs += Allocs - BeginAllocs;
+    r->ops += ops;
+}
+
+
+/**********************************************************
+ * Loading: from the .lvl files, then from the level pack *
+ **********************************************************/
+void LoadFiles(struct result *r)
+{
+    struct world world;
+    struct pack *pack = LevelPack;
+    int level;
+
+    WorldInit(&world);
+    LevelPack = NULL;
+    for (level = 0; level < Levels; level++)
+    {
+        Start();
+        LoadLevel(&world, level);
+        Stop(r, 1);
+    }
+    LevelPack = pack;
+    WorldFree(&world);
+}
+
+void LoadPack(struct result *r)
+{
+    struct world world;
+    int level;
+
+    WorldInit(&world);
+    for (level = 0; level < Levels; level++)
+    {
+        Start();
+        LoadLevel(&world, level);
+        Stop(r, 1);
+    }
+    WorldFree(&world);
+}
+
+
+/*****************************************************************
+ * One physics phase called over and over from the level's start *
+ *****************************************************************/
+void Phase(struct result *r, void (*phase)(struct world *world))
+{
+    struct world world;
+    void *state;
+    int level, k;
+
+    for (level = 0; level < Levels; level++)
+    {
+        WorldStart(&world, level, level + 1);
+        if (!(state = malloc(StateSize(&world))))
+            exit(fprintf(stderr, "Out of memory\n"));
+        StateSave(&world, state);
+        StateLoad(&world, state); // Every rock awake, as after a restart
+
+        Start();
+        for (k = 0; k < ROUND_CALLS; k++)
+            phase(&world);
+        Stop(r, ROUND_CALLS);
+
+        free(state);
+        WorldFree(&world);
+    }
+}
+
+void Rocks(struct result *r)
+{
+    Phase(r, MoveRocks);
+}
+
+void RocksBitboard(struct result *r)
+{
+    Phase(r, MoveRocksBitboard);
+}
+
+void Boxes(struct result *r)
+{
+    Phase(r, MoveBoxes);
+}
+
+
+/*******************************************
+ * FindObject of every kind it is used for *
+ *******************************************/
+void Find(struct result *r)
+{
+    static const int kinds[] = {HERO, DOOR, BOX, FLY, DIAMOND, CRASH};
+    struct world world;
+    int level, k, y, x;
+
+    WorldInit(&world);
+    for (level = 0; level < Levels; level++)
+    {
+        LoadLevel(&world, level);
+        Start();
+        for (k = 0; k < (int)(sizeof(kinds) / sizeof(kinds[0])); k++)
+            FindObject(&world, kinds[k], &y, &x);
+        Stop(r, sizeof(kinds) / sizeof(kinds[0]));
+    }
+    WorldFree(&world);
+}
+
+
+/************************************************
+ * Whole ticks with random keys, on each engine *
+ ************************************************/
+void Steps(struct result *r, enum physics physics)
+{
+    struct world world;
+    unsigned keys = 1;
+    int level, t;
+
+    for (level = 0; level < Levels; level++)
+    {
+        WorldStart(&world, level, level + 1);
+        world.physics = physics;
+        Start();
+        for (t = 0; t < STEP_TICKS; t++)
+            WorldStep(&world, t % KEY_TICKS ? INPUT_NONE
+                : RandomInput(&keys));
+        Stop(r, STEP_TICKS);
+        WorldFree(&world);
+    }
+}
+
+void StepsScalar(struct result *r)
+{
+    Steps(r, PHYSICS_SCALAR);
+}
+
+void StepsBitboard(struct result *r)
+{
+    Steps(r, PHYSICS_BITBOARD);
+}
+
+
+/*****************************************************************
+ * The screen as the game window shows it, drawn by the CPU into *
+ * memory (canvas.c): the view around the hero, every cell on a  *
+ * new board or a scroll, the changed cells otherwise, and the   *
+ * status line when its text changes. One op is one frame, a     *
+ * tick of the game before each.                                 *
+ *****************************************************************/
+void View(struct result *r)
+{
+    struct world world;
+    struct canvas canvas;
+    unsigned keys = 1;
+    int level, t, events, status;
+
+    for (level = 0; level < Levels; level++)
+    {
+        WorldStart(&world, level, level + 1);
+        CanvasInit(&canvas);
+        status = 0;
+        for (t = 0; t < STEP_TICKS; t++)
+        {
+            events = WorldStep(&world, t % KEY_TICKS ? INPUT_NONE
+                : RandomInput(&keys));
+            if (events & WORLD_PHYSICS)
+                status = events;
+
+            Start();
+            Draw(&canvas, &world, status);
+            Stop(r, 1);
+        }
+        CanvasFree(&canvas);
+        WorldFree(&world);
+    }
+}
+
+
+/*************************************************
+ * Rounds of a benchmark for at least MinSeconds *
+ *************************************************/
+void Run(const char *name, void (*bench)(struct result *r))
+{
+    struct result r = {0, 0, 0};
+
+    while (r.seconds < MinSeconds)
+        bench(&r);
+
+    printf("%s\t%ld\t%.1f\t%.0f\t%.3f\n", name, r.ops,
+        r.seconds * 1e9 / r.ops, r.ops / r.seconds, (double)r.allocs / r.ops);
+    fflush(stdout);
+}
+
+
+void Usage(void)
+{
+    fprintf(stderr, "usage: bench [-t min_seconds] [-L pack] [benchmark ...]\n"
+        "benchmarks: load_file load_pack move_rocks move_rocks_bitboard\n"
+        "            move_boxes find_object step step_bitboard view\n");
+    exit(1);
+}
+
+
+/********
+ * Main *
+ ********/
+int main(int argc, char **argv)
+{
+    static const struct
+    {
+        const char *name;
+        void (*bench)(struct result *r);
+    } benches[] = {
+        {"load_file", LoadFiles}, {"load_pack", LoadPack},
+        {"move_rocks", Rocks}, {"move_rocks_bitboard", RocksBitboard},
+        {"move_boxes", Boxes}, {"find_object", Find},
+        {"step", StepsScalar}, {"step_bitboard", StepsBitboard},
+        {"view", View}};
+    struct world world;
+    const char *pack = NULL, *bitmap;
+    int opt, i, k, found;
+
+    while ((opt = getopt(argc, argv, "t:L:")) != -1)
+        switch (opt)
+        {
+            case 't': MinSeconds = atof(optarg); break;
+            case 'L': pack = optarg; break;
+            default: Usage();
+        }
+
+    // The tile rules, the built in ones when there is no file
+    if ((i = RulesLoad(RULES_FILE)) > 0)
+        exit(fprintf(stderr, "Bad rule in %s line %d\n", RULES_FILE, i));
+
+    if ((bitmap = CanvasLoad()) != NULL)
+        exit(fprintf(stderr, "Could not load %s\n", bitmap));
+
+    // Every res/*.lvl file, loaded from the pack when there is one
+    WorldInit(&world);
+    while (LoadLevel(&world, Levels) == 0)
+        Levels++;
+    WorldFree(&world);
+    if (!Levels)
+        exit(fprintf(stderr, "No levels in res/\n"));
+    if ((pack ? PackOpen(&Pack, pack) : PackOpenDefault(&Pack)) == 0)
+        LevelPack = &Pack;
+    else
+    if (pack)
+        exit(fprintf(stderr, "Could not read %s\n", pack));
+
+    printf("# levels %d sweep %s allocs %s\n", Levels, SweepName(),
+#ifdef COUNT_ALLOCS
+        "counted"
+#else
+        "not_counted"
+#endif
+        );
+    printf("benchmark\tops\tns_per_op\tops_per_s\tallocs_per_op\n");
+    for (k = 0; k < (int)(sizeof(benches) / sizeof(benches[0])); k++)
+    {
+        found = optind == argc;
+        for (i = optind; i < argc; i++)
+            found |= !strcmp(argv[i], benches[k].name);
+        // Without a pack LoadLevel reads the files, not worth the name
+        if (found && benches[k].bench == LoadPack && !LevelPack)
+            printf("# %s skipped, no level pack up to date\n",
+                benches[k].name);
+        else
+        if (found)
+            Run(benches[k].name, benches[k].bench);
+    }
+
+    return 0;
+}
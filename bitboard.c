@@ -0,0 +1,203 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "world.h"
+#include "bitboard.h"
+#include "rules.h"
+
+
+/***************************************
+ * Are the planes those of this board? *
+ ***************************************/
+static int Current(struct world *world, int h, int w)
+{
+    return world->bitboard.rows
+        && world->bitboard.generation == world->generation
+        && h >= 0 && h < world->height && w >= 0 && w < world->width;
+}
+
+// Cells of the row holding a tile with the rule
+static uint64_t Union(const uint64_t *row, unsigned rule)
+{
+    uint64_t bits = 0;
+
+    for (; rule; rule &= rule - 1)
+        bits |= row[__builtin_ctz(rule)];
+    return bits;
+}
+
+static void BitboardBuild(struct world *world)
+{
+    struct bitboard *bb = &world->bitboard;
+    const unsigned char *span, *flags;
+    int h, w, n, k;
+
+    if (bb->height != world->height)
+    {
+        free(bb->rows);
+        bb->height = world->height;
+        if (!(bb->rows = malloc(bb->height * sizeof(*bb->rows))))
+            exit(fprintf(stderr, "Out of memory\n"));
+    }
+
+    for (h = 0; h < world->height; h++)
+    {
+        for (k = 0; k < BITBOARD_PLANES; k++)
+            bb->rows[h][k] = 0;
+        for (w = 0; w < world->width; w += n)
+        {
+            span = BoardSpan(world, h, w, &n);
+            flags = FlagsSpan(world, h, w, &n);
+            for (k = 0; k < n; k++)
+            {
+                bb->rows[h][span ? span[k] : world->fill]
+                    |= (uint64_t)1 << (w + k);
+                if (flags && (flags[k] & FLAG_ROCK_MOVE))
+                    bb->rows[h][BITBOARD_MOVING] |= (uint64_t)1 << (w + k);
+            }
+        }
+        bb->rows[h][BITBOARD_FALLS] = Union(bb->rows[h], Rules.falls);
+        bb->rows[h][BITBOARD_SOLID] = Union(bb->rows[h], Rules.solid);
+        bb->rows[h][BITBOARD_EXPLOSIVE] = Union(bb->rows[h], Rules.explosive);
+    }
+    bb->generation = world->generation;
+}
+
+void BitboardFree(struct world *world)
+{
+    free(world->bitboard.rows);
+    world->bitboard.rows = NULL;
+    world->bitboard.height = 0;
+}
+
+
+/**********************************************************
+ * Cells w + each bit of bits in row h changed old into v *
+ **********************************************************/
+// Plane of the tiles with the rule
+static void Rule(uint64_t *plane, unsigned rule, uint64_t bits, int old,
+    int v)
+{
+    if (rule >> old & 1)
+        *plane &= ~bits;
+    if (rule >> v & 1)
+        *plane |= bits;
+}
+
+void BitboardTile(struct world *world, int h, int w, uint64_t bits, int old,
+    int v)
+{
+    uint64_t *row;
+
+    if (!Current(world, h, w))
+        return;
+    row = world->bitboard.rows[h];
+    row[old] &= ~(bits << w);
+    row[v] |= bits << w;
+    Rule(&row[BITBOARD_FALLS], Rules.falls, bits << w, old, v);
+    Rule(&row[BITBOARD_SOLID], Rules.solid, bits << w, old, v);
+    Rule(&row[BITBOARD_EXPLOSIVE], Rules.explosive, bits << w, old, v);
+}
+
+void BitboardMoving(struct world *world, int h, int w, int v)
+{
+    if (!Current(world, h, w))
+        return;
+    if (v == MOVING)
+        world->bitboard.rows[h][BITBOARD_MOVING] |= (uint64_t)1 << w;
+    else
+        world->bitboard.rows[h][BITBOARD_MOVING] &= ~((uint64_t)1 << w);
+}
+
+
+/****************************************************************
+ * Row with nothing but rocks falling straight down: no random  *
+ * numbers, no crash, and no rock can change what another does, *
+ * so the whole row moves at once                               *
+ ****************************************************************/
+static void RowFalls(struct world *world, int j, uint64_t rocks)
+{
+    uint64_t (*r)[BITBOARD_PLANES] = world->bitboard.rows + j;
+    uint64_t bits;
+    int i, t;
+
+    for (bits = rocks & r[1][TUNNEL]; bits; bits &= bits - 1)
+    {
+        i = __builtin_ctzll(bits);
+        for (t = 0; !(r[0][t] >> i & 1); t++) // The plane it is in
+            ;
+        SetBoard(world, j + 1, i, t);
+        SetBoard(world, j, i, TUNNEL);
+        SetRockMove(world, j + 1, i, MOVING);
+    }
+    for (bits = rocks & r[0][BITBOARD_MOVING]; bits; bits &= bits - 1)
+        SetRockMove(world, j, __builtin_ctzll(bits), STILL);
+}
+
+
+/***************************************************************
+ * Row with a rock rolling or crashing: one by one in the scan *
+ * order, the next rock taken from the planes as they are now  *
+ ***************************************************************/
+static void RowInOrder(struct world *world, int j, uint64_t inner)
+{
+    uint64_t (*r)[BITBOARD_PLANES] = world->bitboard.rows + j;
+    uint64_t rocks;
+    int i = (j % 2) ? world->width - 2 : 1;
+
+    while (i > 0 && i < world->width - 1)
+    {
+        rocks = r[0][BITBOARD_FALLS] & inner;
+        rocks &= (j % 2) ? ((uint64_t)2 << i) - 1 : ~(uint64_t)0 << i;
+        if (!rocks)
+            break;
+
+        i = (j % 2) ? 63 - __builtin_clzll(rocks) : __builtin_ctzll(rocks);
+        MoveRock(world, j, i);
+        i += (j % 2) ? -1 : 1;
+    }
+}
+
+
+/***************************************************
+ * This function control rock and diamonds falling *
+ ***************************************************/
+void MoveRocksBitboard(struct world *world)
+{
+    uint64_t (*r)[BITBOARD_PLANES];
+    uint64_t inner, rocks, solid, side, hit;
+    int j;
+
+    if (world->width > BITBOARD_WIDTH)
+    {
+        MoveRocks(world);
+        return;
+    }
+    if (world->width < 3)
+        return;
+    if (!Current(world, 0, 0))
+        BitboardBuild(world);
+
+    // Same rows as the scan; a row only changes itself and the rows below
+    inner = ((uint64_t)1 << (world->width - 1)) - 2;
+    for (j = world->height - 2; j > 0; j--)
+    {
+        r = world->bitboard.rows + j;
+        rocks = r[0][BITBOARD_FALLS] & inner;
+        if (!rocks)
+            continue;
+
+        solid = r[1][BITBOARD_SOLID];
+        side = r[0][TUNNEL] & r[1][TUNNEL];
+        hit = (r[1][HERO] & r[0][BITBOARD_MOVING]) | r[1][BITBOARD_EXPLOSIVE];
+
+        if (rocks & ((solid & (side << 1 | side >> 1)) | hit))
+            RowInOrder(world, j, inner);
+        else
+            RowFalls(world, j, rocks);
+    }
+}
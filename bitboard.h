@@ -0,0 +1,25 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <stdint.h>
+#include "world.h"
+
+/*
+ * Rocks and diamonds moved with whole-row masks. Same result as MoveRocks,
+ * bit for bit, with the same random numbers; boards wider than
+ * BITBOARD_WIDTH fall back to MoveRocks.
+ */
+void MoveRocksBitboard(struct world *world);
+
+/* Kept up to date by the board access functions */
+void BitboardTile(struct world *world, int h, int w, uint64_t bits, int old,
+    int v);
+void BitboardMoving(struct world *world, int h, int w, int v);
+void BitboardFree(struct world *world);
+
+#endif
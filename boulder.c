@@ -5,66 +5,38 @@
  
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_ttf.h"
-
-#define LEVELS_WIDTH        40
-#define LEVELS_HIGH         22
-
-#define TILE_SIZE           30
-#define BITMAP_MAX          14
-
-#define SCREEN_SIZE_X       640
-#define SCREEN_SIZE_Y       480
-
-#define X_MARGIN            5
-#define Y_MARGIN            5
-
-#if (SCREEN_SIZE_X / TILE_SIZE) < LEVELS_WIDTH
-    #define BOARD_WIDTH     (SCREEN_SIZE_X / TILE_SIZE)
-#else
-    #define BOARD_WIDTH     LEVELS_WIDTH
-#endif
-#if (SCREEN_SIZE_Y / TILE_SIZE) < LEVELS_HIGH - 1 // -1 for bottom margin
-    #define BOARD_HIGH      ((SCREEN_SIZE_Y / TILE_SIZE) - 1)
-#else
-    #define BOARD_HIGH      LEVELS_HIGH
-#endif
+#include "world.h"
+#include "replay.h"
+#include "pack.h"
+#include "rules.h"
+#include "history.h"
+#include "profile.h"
+#include "audio.h"
+#include "screen.h"
+
+// Tiles drawn in one go: the whole view and the hero once more
+#define BATCH_MAX           (BOARD_WIDTH * BOARD_HIGH + 1)
+
+#define GLYPH_FIRST         ' '
+#define GLYPH_LAST          '~'
+#define LABELS_MAX          8
+#define TEXT_COLOR          ((SDL_Color){255, 0, 0})
 
 #define STANDARD_DELAY      1000
-#define INTER_TIME          60
-
-enum tile {TUNNEL, WALL, HERO, ROCK, DIAMOND, GROUND, METAL, BOX, DOOR, FLY, 
-           CRASH};
-enum hero {KILLED, FACE1, FACE2, RIGHT, LEFT};
-enum sound {SOUND_NONE, SOUND_MOVE, SOUND_DIAMOND, SOUND_EXPLOSION};
-enum direction {NORTH, EAST, SOUTH, WEST};
-enum move {REAL, GHOST};
-enum box_state {STILL, MOVING};
-enum side {FALL_LEFT = -1, FALL_RIGHT = 1};
-
-struct game
-{
-    int current_level;
-    int level_diamonds;   // Total number of diamonds to pick up
-    int level_time;       // Total time to pass the board
-    int diamonds;         // Diamonds left
-    int time;             // Time left
-    enum hero hero_state; // Direction of player
-    enum move move_mode;  // Move mode (real move or action without move)
-    int lastposx, lastposy;
-    int move_time;        // Time of last move (impatience feature)
-    int sound_mode;
-    enum sound sound_to_play;
-};
+#define INTRO_TIME          (STANDARD_DELAY * 2) // Unless a key skips it
+#define ATLAS_CACHE         "res/atlas.cache"
+#define ATLAS_VERSION       1
+#define DECODE_TASKS        BITMAP_MAX // One per tile
 
-struct board_mem
-{
-    unsigned char board:4;
-    unsigned char rock_move:1;
-    unsigned char box_move:1;
-    unsigned char box_dir:2;
-};
+#define TICK_RATE           INTER_TIME // WorldStep calls per second
+#define MAX_CATCH_UP        8          // Ticks run at most before a frame
+#define INPUT_QUEUE         32
+#define REWIND_TICKS        TICK_RATE  // Back per press of the rewind key
 
 /********************
  * Global variables *
@@ -72,641 +44,632 @@ struct board_mem
 SDL_Event Event;
 SDL_Renderer *Renderer;
 SDL_Surface *Surface;
-SDL_Texture *Tiles[BITMAP_MAX];
+SDL_Texture *Atlas;       // All tiles in one row, TILE_SIZE each
 TTF_Font *Font;
+SDL_Texture *BoardCache;  // The view as drawn last time, NULL to draw direct
+int CacheX, CacheY, CacheGeneration = -1;
+enum hero CacheHero;
+unsigned char Drawn[BOARD_HIGH][BOARD_WIDTH]; // Tiles in the cache
+
+// Tiles waiting for FlushTiles
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+SDL_Vertex BatchVertex[BATCH_MAX * 4];
+int BatchIndex[BATCH_MAX * 6];
+#else
+SDL_Rect BatchFrom[BATCH_MAX], BatchTo[BATCH_MAX];
+#endif
+int BatchCount;
+long Frames, DrawCalls;
 
-struct game Game;
-unsigned char Mem[LEVELS_HIGH][LEVELS_WIDTH];
-
-const char BitmapFile[BITMAP_MAX][32] = {"res/tunnel.bmp", "res/wall.bmp",
-    "res/heror.bmp", "res/herol.bmp", "res/hero1.bmp", "res/hero2.bmp",
-    "res/rock.bmp", "res/diamond.bmp", "res/ground.bmp", "res/metal.bmp",
-    "res/door.bmp", "res/box.bmp", "res/crash.bmp", "res/fly.bmp"};
+// Text: every printable character once, and the fixed part of each message
+struct label
+{
+    const char *fstr;     // PrintText format the label was made for
+    SDL_Texture *texture; // Text up to the first conversion, NULL if none
+    int w, h;
+};
 
+SDL_Texture *GlyphAtlas;
+SDL_Surface *GlyphSurface[GLYPH_LAST - GLYPH_FIRST + 1];
+SDL_Rect Glyph[GLYPH_LAST - GLYPH_FIRST + 1];
+struct label Labels[LABELS_MAX];
+int LabelCount;
 
-/*********************************************
- * Access (get/set) to game board properties *
- *********************************************/
-int GetBoard(int h, int w)
+// Keys drained from SDL, waiting for their tick
+struct key
 {
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    return b->board;
-}
+    enum input input;
+    Uint32 time;          // SDL timestamp of the key press
+};
 
-void SetBoard(int h, int w, int v)
-{
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    b->board = v;
-}
+// Single producer, single consumer rings: each side writes its own index
+struct key Keys[INPUT_QUEUE];
+SDL_atomic_t KeysHead, KeysTail; // Taken by the simulation, added by main
 
-int GetRockMove(int h, int w)
+// Key press times of the ticks they were applied in, not yet presented
+struct applied
 {
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    return b->rock_move;
-}
+    long tick;
+    Uint32 time;
+};
 
-void SetRockMove(int h, int w, int v)
+struct applied Applied[INPUT_QUEUE];
+SDL_atomic_t AppliedHead, AppliedTail; // Taken by main, added by the sim
+long Latencies, LatencySum;
+Uint32 LatencyMin = ~(Uint32)0, LatencyMax;
+
+struct world World;       // Owned by the simulation thread once it runs
+struct pack Pack;
+struct replay Replay;
+const char *RecordFile;   // Save the session's input log here on exit
+int Playback;             // Inputs come from Replay, not the keyboard
+struct history History;   // Last ticks played, for the rewind key
+SDL_atomic_t Rewinds;     // Presses of the rewind key not yet done
+
+/*
+ * What the simulation thread shows of one tick: the view and the status
+ * line, copied out of the world. Three of them, so the simulation always
+ * has one to write and the drawing always has a whole one to read, and
+ * neither waits for the other.
+ */
+struct frame
 {
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    b->rock_move = v;
-}
+    long tick;
+    int status;           // WORLD_ bits for the status line
+    struct game game;
+    int generation;       // Of the board, a new one is drawn whole
+    struct view view;
+    unsigned char tile[BOARD_HIGH][BOARD_WIDTH];
+};
 
-int GetBoxMove(int h, int w)
-{
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    return b->box_move;
-}
+#define FRAME_FRESH         4 // In FrameMiddle: published, not yet taken
+
+struct frame FrameBuffer[3];
+SDL_atomic_t FrameMiddle; // Index of the frame in between, | FRAME_FRESH
+int FrameBack = 1;        // Written by the simulation
+int FrameFront = 2;       // Drawn by the main thread
+struct frame *Shown = &FrameBuffer[2];
+SDL_Thread *Simulation;
+SDL_atomic_t Quit;
+
+// Startup: assets decoded on threads while the intro shows
+SDL_Surface *Decoded[BITMAP_MAX]; // Tiles scaled to TILE_SIZE, RGBA8888
+SDL_atomic_t DecodeNext;  // Next task a worker takes
+int DecodeTasks;          // None when the atlas comes cached
+int NoIntro;
+int AtlasCached;
+Uint64 StartCounter;      // Performance counter when main began
+double IntroMs, AssetsMs, FirstFrameMs = -1;
 
-void SetBoxMove(int h, int w, int v)
-{
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    b->box_move = v;
-}
 
-int GetBoxDir(int h, int w)
-{
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    return b->box_dir;
-}
 
-void SetBoxDir(int h, int w, int v)
+/*******************************************************
+ * Play the sounds requested since the last frame, all *
+ * at once, mixed by the audio thread (audio.c)        *
+ *******************************************************/
+void SoundPlay(void)
 {
-    struct board_mem *b = (struct board_mem*)&(Mem[h][w]);
-    b->box_dir = v;
+    int sound;
+
+    if (World.game.sound_mode)
+        for (sound = SOUND_MOVE; sound <= SOUND_EXPLOSION; sound++)
+            if (World.sounds >> sound & 1)
+                AudioPlay(sound);
+
+    World.sounds = 0;
+    World.game.sound_to_play = SOUND_NONE;
 }
 
 
-/*****************
- * Loading level *
- *****************/
-int LoadLevel(int level)
+/******************************************************************
+ * Render the printable characters once, both halves on the       *
+ * main thread as SDL_ttf is not thread safe: the surfaces while  *
+ * the intro shows (RenderGlyphs), the texture after (LoadGlyphs) *
+ ******************************************************************/
+void RenderGlyphs(void)
 {
-    FILE *fp = NULL;
-    char line[LEVELS_WIDTH + 1];
-    int i = 0, j = 0;
+    char text[2] = {0};
+    int i, x = 0, high;
 
-    snprintf(line, sizeof(line), "res/%d.lvl", level + 1);
-    fp = fopen(line, "r");
-    if (fp == NULL)
-        return -1;
+    if (!(Font = TTF_OpenFont("res/font.ttf", TILE_SIZE / 2)))
+        return;
+    high = TTF_FontHeight(Font);
+    for (i = 0; i <= GLYPH_LAST - GLYPH_FIRST; i++)
+    {
+        text[0] = GLYPH_FIRST + i;
+        GlyphSurface[i] = TTF_RenderText_Blended(Font, text, TEXT_COLOR);
+        Glyph[i] = (SDL_Rect){x, 0,
+            GlyphSurface[i] ? GlyphSurface[i]->w : 0, high};
+        x += Glyph[i].w;
+    }
+}
 
-    while (fgets(line, sizeof(line), fp) != NULL)
+void LoadGlyphs(void)
+{
+    SDL_Surface *atlas;
+    int i, x = 0;
+
+    for (i = 0; i <= GLYPH_LAST - GLYPH_FIRST; i++)
+        x += Glyph[i].w;
+    atlas = SDL_CreateRGBSurfaceWithFormat(0, x, TTF_FontHeight(Font), 32,
+        SDL_PIXELFORMAT_RGBA8888);
+    for (i = 0; i <= GLYPH_LAST - GLYPH_FIRST; i++)
     {
-        if (line[0] == '#' || line[0] == 0 || line[0] == 10)
+        if (!GlyphSurface[i])
             continue;
-        if (line[0] == '.')
-        {
-            if (line[1] == 'd' && line[2] == '=')
-                Game.level_diamonds = atoi(line + 3);
-            else
-            if (line[1] == 't' && line[2] == '=')
-                Game.level_time = atoi(line + 3);
-            continue;
-        }
-
-        for (i = 0; i < LEVELS_WIDTH; i++)
-            SetBoard(j, i, line[i] - 48);
-
-        if (++j > LEVELS_HIGH)
-            break;
+        // Copy the coverage as it is, not blended with the empty atlas
+        SDL_SetSurfaceBlendMode(GlyphSurface[i], SDL_BLENDMODE_NONE);
+        if (atlas)
+            SDL_BlitSurface(GlyphSurface[i], NULL, atlas, &Glyph[i]);
+        SDL_FreeSurface(GlyphSurface[i]);
+        GlyphSurface[i] = NULL;
     }
 
-    fclose(fp);
-    return 0;
+    if (!atlas)
+        exit(fprintf(stderr, "Could not create the glyph atlas\n"));
+    GlyphAtlas = SDL_CreateTextureFromSurface(Renderer, atlas);
+    SDL_FreeSurface(atlas);
 }
 
 
-/**************************************
- * This function starts the new board *
- **************************************/
-void StartLevel(int new_level)
+/*******************************************************
+ * The fixed text of the format, rendered on first use *
+ *******************************************************/
+struct label *FindLabel(const char *fstr, int len)
 {
-    if (LoadLevel(new_level) < 0)
-        if (Game.current_level != 0)
-        {
-            Game.current_level = 0;
-            StartLevel(Game.current_level);
-        }
-    Game.time = Game.level_time;
-    Game.move_time = Game.level_time;
-    Game.diamonds = Game.level_diamonds;
-    Game.hero_state = FACE1;
-}
+    struct label *label;
+    SDL_Surface *surface;
+    char text[64];
+    int i;
 
+    for (i = 0; i < LabelCount; i++)
+        if (Labels[i].fstr == fstr)
+            return &Labels[i];
 
-/******************
- * Play the sound *
- ******************/
-void SoundPlay(void)
-{
-    if (Game.sound_mode && Game.sound_to_play != SOUND_NONE)
+    if (LabelCount == LABELS_MAX || len >= (int)sizeof(text))
+        return NULL;
+
+    label = &Labels[LabelCount++];
+    label->fstr = fstr;
+    if (len)
     {
-        // TODO: Play the sound...
-        switch (Game.sound_to_play)
+        memcpy(text, fstr, len);
+        text[len] = 0;
+        surface = TTF_RenderText_Blended(Font, text, TEXT_COLOR);
+        if (surface)
         {
-            case SOUND_MOVE:
-                break;
-            case SOUND_DIAMOND:
-                break;
-            case SOUND_EXPLOSION:
-                break;
-            case SOUND_NONE:
-                break;
+            label->texture = SDL_CreateTextureFromSurface(Renderer, surface);
+            label->w = surface->w;
+            label->h = surface->h;
+            SDL_FreeSurface(surface);
         }
-
-        Game.sound_to_play = SOUND_NONE;
     }
-}
-
 
-/****************************
- * Set the sound to be play *
- ****************************/
-void SoundRequest(int sound)
-{
-    Game.sound_to_play = sound;
+    return label;
 }
 
 
 /******************
- * Make the crash *
+ * Print the text *
  ******************/
-void MakeCrash(int object, int y, int x)
+void PrintText(char *fstr, int value, int x, int y)
 {
-    int j, i;
+    struct label *label;
+    const char *conv;
+    char msg[64];
+    SDL_Rect *g;
+    int i = 0, len;
 
-    for (j = y - 1; j <= y + 1; j++)
-        for (i = x - 1; i <= x + 1; i++)
-            if (GetBoard(j, i) != METAL) 
-                SetBoard(j, i, object);
+    if (!Font || !GlyphAtlas)
+        return;
 
-    SoundRequest(SOUND_EXPLOSION);
+    // The text before the conversion never changes, drawn in one piece
+    conv = strchr(fstr, '%');
+    len = conv ? conv - fstr : (int)strlen(fstr);
+    label = FindLabel(fstr, len);
+    if (label)
+    {
+        if (label->texture)
+        {
+            SDL_RenderCopy(Renderer, label->texture, NULL,
+                &(SDL_Rect){x, y, label->w, label->h});
+            DrawCalls++;
+        }
+        x += label->w;
+        i = len;
+    }
+
+    // The value and whatever follows it, from the glyphs
+    snprintf(msg, sizeof(msg), fstr, value);
+    for (; msg[i]; i++)
+    {
+        if (msg[i] < GLYPH_FIRST || msg[i] > GLYPH_LAST)
+            continue;
+        g = &Glyph[msg[i] - GLYPH_FIRST];
+        SDL_RenderCopy(Renderer, GlyphAtlas, g,
+            &(SDL_Rect){x, y, g->w, g->h});
+        DrawCalls++;
+        x += g->w;
+    }
 }
 
 
-/********************
- * Remove the crash *
- ********************/
-void CrashRemove(void)
+/*****************************************
+ * Draw the tiles batched up by DrawTile *
+ *****************************************/
+void FlushTiles(void)
 {
-    int j, i;
+    if (!BatchCount)
+        return;
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    SDL_RenderGeometry(Renderer, Atlas, BatchVertex, BatchCount * 4,
+        BatchIndex, BatchCount * 6);
+    DrawCalls++;
+#else
+    // No geometry, but still no texture switches
+    {
+        int i;
 
-    for (j = LEVELS_HIGH - 2; j > 0; j--)
-        for (i = 0; i <= LEVELS_WIDTH - 1; i++)
-            if (GetBoard(j, i) == CRASH)
-                SetBoard(j, i, TUNNEL);
+        for (i = 0; i < BatchCount; i++)
+            SDL_RenderCopy(Renderer, Atlas, &BatchFrom[i], &BatchTo[i]);
+    }
+    DrawCalls += BatchCount;
+#endif
+    BatchCount = 0;
 }
 
 
-/***************************************************
- * This function control each other box and fly AI *
- ***************************************************/
-int MoveBox(int j, int i, int d)
+/*********************************************
+ * Queue one tile of the view for FlushTiles *
+ *********************************************/
+void DrawTile(int item, int x, int y)
 {
-    int dj = j, di = i;
+    int t = SelectTile(item, Shown->game.hero_state);
 
-    if (d > WEST)
-        d -= (WEST + 1);
-    if (d < NORTH)
-        d = WEST;
+    if (BatchCount == BATCH_MAX)
+        FlushTiles();
 
-    switch (d)
+    // The cache holds the view only, the screen has the margins
+    if (!BoardCache)
     {
-        case NORTH: dj -= 1; break;
-        case EAST:  di += 1; break;
-        case SOUTH: dj += 1; break;
-        case WEST:  di -= 1; break;
-    }
-
-    if (GetBoard(dj, di) == HERO)
+        x = x * TILE_SIZE + X_MARGIN;
+        y = y * TILE_SIZE + Y_MARGIN;
+    } else
     {
-        if (GetBoard(j, i) == BOX)
-            MakeCrash(CRASH, dj, di);
-        else
-            MakeCrash(DIAMOND, dj, di);
-        return 1;
+        x *= TILE_SIZE;
+        y *= TILE_SIZE;
     }
 
-    if (GetBoard(dj, di) == TUNNEL)
+#if SDL_VERSION_ATLEAST(2, 0, 18)
     {
-        if (GetBoard(j, i) == BOX)
-            SetBoard(dj, di, BOX);
-        else
-            SetBoard(dj, di, FLY);
-        SetBoard(j, i, TUNNEL);
-        SetBoxMove(dj, di, MOVING);
-        SetBoxDir(dj, di, d);
-        return 1;
+        SDL_Vertex *v = &BatchVertex[BatchCount * 4];
+        float u0 = (float)t / BITMAP_MAX, u1 = (float)(t + 1) / BITMAP_MAX;
+        SDL_Color c = {255, 255, 255, 255};
+
+        v[0] = (SDL_Vertex){{x, y}, c, {u0, 0}};
+        v[1] = (SDL_Vertex){{x + TILE_SIZE, y}, c, {u1, 0}};
+        v[2] = (SDL_Vertex){{x + TILE_SIZE, y + TILE_SIZE}, c, {u1, 1}};
+        v[3] = (SDL_Vertex){{x, y + TILE_SIZE}, c, {u0, 1}};
     }
-
-    return 0;
+#else
+    BatchFrom[BatchCount] = (SDL_Rect){t * TILE_SIZE, 0, TILE_SIZE, TILE_SIZE};
+    BatchTo[BatchCount] = (SDL_Rect){x, y, TILE_SIZE, TILE_SIZE};
+#endif
+    BatchCount++;
 }
 
 
-/**********************************************
- * This function control boxs's and flys's AI *
- **********************************************/
-void MoveBoxes(void)
+/*************************************************
+ * Bring the cached view of the board up to date *
+ *************************************************/
+void UpdateView(void)
 {
-    int j, i, d;
-
-    for (j = LEVELS_HIGH - 2; j > 0; j--)
-        for (i = 1; i < LEVELS_WIDTH - 1; i++)
-            SetBoxMove(j, i, STILL);
+    struct frame *f = Shown;
+    int y, x, full, hero;
+
+    // A new board or a scroll makes every cell of the cache stale
+    full = !BoardCache || f->view.startx != CacheX || f->view.starty != CacheY
+        || f->generation != CacheGeneration;
+    if (BoardCache)
+        SDL_SetRenderTarget(Renderer, BoardCache);
+    if (full)
+    {
+        SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
+        SDL_RenderClear(Renderer);
+    }
 
-    for (j = LEVELS_HIGH - 2; j > 0; j--)
-        for (i = 1; i < LEVELS_WIDTH - 1; i++)
-            if ((GetBoard(j, i) == BOX || GetBoard(j, i) == FLY) 
-                && GetBoxMove(j, i) == STILL)
+    // The changed cells only; the hero sprite changes on its own too
+    hero = f->game.hero_state != CacheHero;
+    for (y = 0; y < f->view.high; y++)
+        for (x = 0; x < f->view.width; x++)
+            if (full || f->tile[y][x] != Drawn[y][x]
+                || (hero && f->tile[y][x] == HERO))
             {
-                for (d = GetBoxDir(j, i) - 1; d <= GetBoxDir(j, i) + 2; d++)
-                    if (MoveBox(j, i, d))
-                        break;
+                DrawTile(f->tile[y][x], x, y);
+                Drawn[y][x] = f->tile[y][x];
             }
+    FlushTiles();
+
+    if (BoardCache)
+        SDL_SetRenderTarget(Renderer, NULL);
+    CacheX = f->view.startx;
+    CacheY = f->view.starty;
+    CacheGeneration = f->generation;
+    CacheHero = f->game.hero_state;
 }
 
 
-/*******************************************
- * Falling rock and diamonds on given side *
- *******************************************/
-void FallingOnSide(int j, int i, int side)
+/********************************************************
+ * Write time, score, etc and the end of the Game state *
+ ********************************************************/
+void ShowStatus(int events)
 {
-    if (GetBoard(j, i + side) == TUNNEL 
-        && GetBoard(j + 1, i + side) == TUNNEL)
+    SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(Renderer, 
+        &(SDL_Rect){0, STATUS_Y, SCREEN_SIZE_X, SCREEN_SIZE_Y - STATUS_Y});
+
+    if (events & WORLD_GAME_OVER)
+    {
+        PrintText(" * Game Over * ", 0, END_X, TEXT_Y);
+    } else
+    if (events & WORLD_LEVEL_DONE)
+    {
+        PrintText(" * Level %d * ", Shown->game.current_level + 1, 
+            END_X, TEXT_Y);
+    } else
     {
-        SetBoard(j, i + side, GetBoard(j, i));
-        SetBoard(j, i, TUNNEL);
-        SetRockMove(j, i + side, MOVING);
+        PrintText("    Level  %2u", Shown->game.current_level + 1, 
+            LEVEL_X, TEXT_Y);
+        PrintText("   Diam  %3u", Shown->game.diamonds, DIAMONDS_X, TEXT_Y);
+        PrintText("Time  %3u", Shown->game.time, TIME_X, TEXT_Y);
+        PrintText("%c", (Shown->game.sound_mode)?' ':'M', MUTE_X, TEXT_Y);
     }
 }
 
 
-/***************************************************
- * This function control rock and diamonds falling *
- ***************************************************/
-void MoveRocks(void)
+/*************************************************
+ * Compose the cached board and the status, once *
+ *************************************************/
+void ShowFrame(void)
 {
-    int j, i;
+    // The world is already on the next level, the screen is not yet
+    PROFILE_BEGIN(PHASE_FRAME);
+    if (!(Shown->status & WORLD_LEVEL_DONE))
+    {
+        PROFILE_BEGIN(PHASE_VIEW);
+        UpdateView();
+        PROFILE_END(PHASE_VIEW);
+    }
 
-    for (j = LEVELS_HIGH - 2; j > 0; j--)
-        for (i = (j % 2) ? LEVELS_WIDTH - 2 : 1;
-             (j % 2) ? i > 0 : i < LEVELS_WIDTH - 1;
-             (j % 2) ? i-- : i++)
-        {
-            if (GetBoard(j, i) == ROCK || GetBoard(j, i) == DIAMOND)
-            {
-                // Falling rock or diamond on right or left
-                if (GetBoard(j + 1, i) == ROCK
-                    || GetBoard(j + 1, i) == DIAMOND
-                    || GetBoard(j + 1, i) == WALL
-                    || GetBoard(j + 1, i) == DOOR
-                    || GetBoard(j + 1, i) == METAL)
-                {
-                    if (rand() & 1)
-                        FallingOnSide(j, i, FALL_RIGHT);                        
-                    else
-                        FallingOnSide(j, i, FALL_LEFT);
-                }
-
-                // Falling down
-                if (GetBoard(j + 1, i) == TUNNEL)
-                {
-                    SetBoard(j + 1, i, GetBoard(j, i));         
-                    SetBoard(j, i, TUNNEL);
-                    SetRockMove(j + 1, i, MOVING);
-                }
-
-                // Rock or diamond kills the player
-                if (GetBoard(j + 1, i) == HERO && GetRockMove(j, i) == MOVING)
-                    MakeCrash(CRASH, j + 1, i);
-                
-                // Rock or diamond kills the BOX
-                if (GetBoard(j + 1, i) == BOX)
-                    MakeCrash(CRASH, j + 1, i);
-                if (GetBoard(j + 1, i) == FLY)
-                    MakeCrash(DIAMOND, j + 1, i);
-                
-                SetRockMove(j, i, STILL);
-            }
-        }
+    if (BoardCache)
+    {
+        SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
+        SDL_RenderClear(Renderer);
+        SDL_RenderCopy(Renderer, BoardCache, NULL, &(SDL_Rect){X_MARGIN,
+            Y_MARGIN, BOARD_WIDTH * TILE_SIZE, BOARD_HIGH * TILE_SIZE});
+        DrawCalls++;
+    }
+    PROFILE_BEGIN(PHASE_STATUS);
+    ShowStatus(Shown->status);
+    PROFILE_END(PHASE_STATUS);
+    PROFILE_BEGIN(PHASE_PRESENT);
+    SDL_RenderPresent(Renderer);
+    PROFILE_END(PHASE_PRESENT);
+    PROFILE_END(PHASE_FRAME);
+    Frames++;
 }
 
 
-/**********************************
- * This function finds the object *
- **********************************/
-int FindObject(int object, int *y, int *x)
+// Milliseconds since main began
+double Elapsed(void)
 {
-    int j, i;
-
-    for (j = 1; j < LEVELS_HIGH - 1; j++)
-        for (i = 1; i < LEVELS_WIDTH - 1; i++)
-            if (GetBoard(j, i) == object)
-            {
-                if (y != 0)
-                    *y = j;
-                if (x != 0)
-                    *x = i;
-                return object; // Object found
-            }
-    return (-1); // Object not found
+    return (SDL_GetPerformanceCounter() - StartCounter) * 1000.0
+        / SDL_GetPerformanceFrequency();
 }
 
 
-/**********************************
- * This function moves the player *
- **********************************/
-void MoveHero(int y, int x)
+/******************
+ * Show the intro *
+ ******************/
+void ShowIntro(void)
 {
-    int j, i, o;
+    SDL_Texture *intro;
 
-    if (FindObject(HERO, &j, &i) != HERO)
-        return;
+    Surface = SDL_LoadBMP("res/intro.bmp");
+    intro = SDL_CreateTextureFromSurface(Renderer, Surface);
+    SDL_RenderCopy(Renderer, intro, NULL, &(SDL_Rect){0, 0,
+        SCREEN_SIZE_X, SCREEN_SIZE_Y});
+    SDL_RenderPresent(Renderer);
+    SDL_DestroyTexture(intro);
+    SDL_FreeSurface(Surface);
+    IntroMs = Elapsed();
+}
 
-    o = GetBoard(j + y, i + x);
+// The intro stays INTRO_TIME, a key or a click ends it sooner
+void WaitIntro(void)
+{
+    Uint32 shown = SDL_GetTicks(), now;
 
-    switch (o)
+    while (!NoIntro && (now = SDL_GetTicks()) - shown < INTRO_TIME)
     {
-        case DIAMOND: // Get the diamond
-            if (Game.diamonds)
-                Game.diamonds--;
-            SoundRequest(SOUND_DIAMOND);
-            break;      
-        case ROCK: // Push the rock
-            if (x > 0)
-                if (GetBoard(j, i + x + 1) == TUNNEL)
-                {
-                    SetBoard(j, i + x, TUNNEL);
-                    SetBoard(j, i + x + 1, ROCK);
-                }
-            if (x < 0)
-                if (GetBoard(j, i + x - 1) == TUNNEL)
-                {
-                    SetBoard(j, i + x, TUNNEL);
-                    SetBoard(j, i + x - 1, ROCK);
-                }
-            o = GetBoard(j + y, i + x);
+        if (!SDL_WaitEventTimeout(&Event, INTRO_TIME - (now - shown)))
+            continue;
+        if (Event.type == SDL_QUIT)
+            exit(0);
+        if (Event.type == SDL_KEYDOWN || Event.type == SDL_MOUSEBUTTONDOWN)
             break;
-        case BOX:
-            MakeCrash(CRASH, j + y, i + x);
-            return;
-        case FLY:
-            MakeCrash(DIAMOND, j + y, i + x);
-            return;
     }
-
-    // Move player if it's possible
-    if (o != WALL && o != ROCK && o != METAL
-         && j + y >= 0 && i + x >= 0 
-         && j + y < LEVELS_HIGH && i + x < LEVELS_WIDTH
-         && (o != DOOR || !Game.diamonds))
-    {
-        if (Game.move_mode == REAL)
-        {
-            SetBoard(j, i, TUNNEL);
-            SetBoard(j + y, i + x, HERO);
-        } else
-        {
-            SetBoard(j + y, i + x, TUNNEL);
-        }
-        if (Game.sound_to_play == SOUND_NONE)
-            SoundRequest(SOUND_MOVE);
-    }
-
-    Game.move_mode = REAL;
-    Game.move_time = Game.time;
-    return;
+    SDL_RenderClear(Renderer);
 }
 
 
-/***************
- * Kill player *
- ***************/
-void KillHero(void)
+/*****************************************************************
+ * Decoding on worker threads: each takes the next task until    *
+ * none is left. No renderer calls here, only surfaces; the main *
+ * thread makes the textures.                                    *
+ *****************************************************************/
+void DecodeTile(int i)
 {
-    int y, x;
+    SDL_Surface *bitmap = SDL_LoadBMP(BitmapFile[i]), *tile;
 
-    if (FindObject(HERO, &y, &x) == HERO)
-        MakeCrash(CRASH, y, x);
+    if (!bitmap)
+        return;
+    tile = SDL_CreateRGBSurfaceWithFormat(0, TILE_SIZE, TILE_SIZE, 32,
+        SDL_PIXELFORMAT_RGBA8888);
+    if (tile)
+        SDL_BlitScaled(bitmap, NULL, tile, NULL);
+    SDL_FreeSurface(bitmap);
+    Decoded[i] = tile;
 }
 
-
-/******************
- * Print the text *
- ******************/
-void PrintText(char *fstr, int value, int x, int y)
+int DecodeWorker(void *arg)
 {
-    int w, h;
-    char msg[64];
-
-    if (!Font)
-        return;
+    int task;
 
-    snprintf(msg, 64, fstr, value);
-    TTF_SizeText(Font, msg, &w, &h);
-    SDL_Surface *msgsurf = TTF_RenderText_Blended(
-        Font, msg, (SDL_Color){255, 0, 0});
-    SDL_Texture *msgtex = SDL_CreateTextureFromSurface(Renderer, msgsurf);
-    SDL_Rect fromrec = {0, 0, msgsurf->w, msgsurf->h};
-    SDL_Rect torec = {x, y, msgsurf->w, msgsurf->h};
-    SDL_RenderCopy(Renderer, msgtex, &fromrec, &torec);
-    SDL_DestroyTexture(msgtex);
-    SDL_FreeSurface(msgsurf);
+    (void)arg;
+    while ((task = SDL_AtomicAdd(&DecodeNext, 1)) < DecodeTasks)
+        DecodeTile(task);
+    return 0;
 }
 
 
-/*******************************
- * Select the appropriate tile *
- *******************************/
-int SelectTile(int item, int posx, int posy)
+/*****************************************************************
+ * Atlas cache: the tiles as they go into the texture, valid     *
+ * while no bitmap is newer. Written once, then nothing to       *
+ * decode at startup. Native byte order, it never leaves the box *
+ *****************************************************************/
+struct atlas_header
 {
-    int t;
+    char magic[4];        // "BPAT"
+    Uint32 version, tile_size, count;
+};
 
-    switch (item)
-    {
-        case TUNNEL: t = 0; break;
-        case WALL:   t = 1; break;
-        case HERO:
-            switch (Game.hero_state)
-            {
-                case RIGHT: t = 2; break;
-                case LEFT:  t = 3; break;
-                case FACE1: t = 4; break;
-                case FACE2: t = 5; break;
-                default:    t = 4;
-            }
-            break;
-        case ROCK:    t = 6; break;
-        case DIAMOND: t = 7; break;
-        case GROUND:  t = 8; break;
-        case METAL:   t = 9; break;
-        case BOX:     t = 11; break;
-        case DOOR:    t = 10; break;
-        case FLY:     t = 13; break;
-        case CRASH:   t = 12; break;
-        default:      t = 0;
-    }
+int AtlasCacheValid(void)
+{
+    struct stat cache, bitmap;
+    int i;
 
-    return t;
+    if (stat(ATLAS_CACHE, &cache) < 0)
+        return 0;
+    for (i = 0; i < BITMAP_MAX; i++)
+        if (stat(BitmapFile[i], &bitmap) == 0
+            && bitmap.st_mtime >= cache.st_mtime)
+            return 0;
+    return 1;
 }
 
-
-/**********************************************************
- * This function draw currently visable part of the board *
- **********************************************************/
-void ShowView(void)
+SDL_Surface *LoadAtlasCache(void)
 {
-    int starty, startx, posy, posx, y, x;
-
-    // Find the player
-    if (FindObject(HERO, &starty, &startx) < 0)
-    {
-        startx = Game.lastposx;
-        starty = Game.lastposy;
-        Game.hero_state = KILLED;
-    } else
-    {
-        Game.lastposx = startx;
-        Game.lastposy = starty;
-    }
+    struct atlas_header header;
+    SDL_Surface *atlas = NULL;
+    FILE *fp;
+    int y, ok;
+
+    if (!AtlasCacheValid() || !(fp = fopen(ATLAS_CACHE, "rb")))
+        return NULL;
+    ok = fread(&header, sizeof(header), 1, fp) == 1
+        && !memcmp(header.magic, "BPAT", 4)
+        && header.version == ATLAS_VERSION
+        && header.tile_size == TILE_SIZE && header.count == BITMAP_MAX
+        && (atlas = SDL_CreateRGBSurfaceWithFormat(0,
+            BITMAP_MAX * TILE_SIZE, TILE_SIZE, 32, SDL_PIXELFORMAT_RGBA8888));
+    for (y = 0; ok && y < TILE_SIZE; y++)
+        ok = fread((Uint8 *)atlas->pixels + y * atlas->pitch,
+            BITMAP_MAX * TILE_SIZE * 4, 1, fp) == 1;
+    fclose(fp);
 
-    // Scrolling the board
-    startx -= BOARD_WIDTH / 2;
-    if (startx < 0)
-        startx = 0;
-    if (startx > LEVELS_WIDTH - BOARD_WIDTH)
-        startx = LEVELS_WIDTH - BOARD_WIDTH;
-
-    starty -= BOARD_HIGH / 2;
-    if (starty < 0)
-        starty = 0;
-    if (starty > LEVELS_HIGH - BOARD_HIGH)
-        starty = LEVELS_HIGH - BOARD_HIGH;
-
-    // Draw the board
-    posy = starty;
-    for (y = 0; y < BOARD_HIGH; y++)
+    if (!ok)
     {
-        posx = startx;
-        for (x = 0; x < BOARD_WIDTH; x++)
-        {
-            int t = SelectTile(GetBoard(posy, posx), x, y);
-            SDL_RenderCopy(Renderer, Tiles[t], NULL, 
-                &(SDL_Rect){x * TILE_SIZE + X_MARGIN, y * TILE_SIZE + Y_MARGIN, 
-                TILE_SIZE, TILE_SIZE});
-            posx++;
-        }
-        posy++;
+        SDL_FreeSurface(atlas);
+        return NULL;
     }
-
-    SDL_RenderPresent(Renderer);
+    return atlas;
 }
 
-
-/*******************************************************
- * Write time, score, etc and end of the Game checking *
- *******************************************************/
-void ShowStatus(void)
+// Through a temporary file, a kiosk may be switched off any time
+void SaveAtlasCache(SDL_Surface *atlas)
 {
-    SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
-    SDL_RenderFillRect(Renderer, 
-        &(SDL_Rect){0, SCREEN_SIZE_Y - TILE_SIZE + Y_MARGIN, 
-        SCREEN_SIZE_X, TILE_SIZE - Y_MARGIN});
-
-    if (!Game.time || Game.hero_state == KILLED)
-    {
-        if (Game.hero_state != KILLED)
-            KillHero();
-        PrintText(" * Game Over * ", 0, (int)(SCREEN_SIZE_X / 3), 
-            (int)(SCREEN_SIZE_Y - TILE_SIZE / 1.5));
-        SDL_RenderPresent(Renderer);
-    } else
-    if (!Game.diamonds && FindObject(DOOR, 0, 0) < 0)
+    struct atlas_header header = {{'B', 'P', 'A', 'T'}, ATLAS_VERSION,
+        TILE_SIZE, BITMAP_MAX};
+    FILE *fp = fopen(ATLAS_CACHE ".tmp", "wb");
+    int y, ok;
+
+    if (!fp)
+        return; // Read only res/, decode every time
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (y = 0; ok && y < TILE_SIZE; y++)
+        ok = fwrite((Uint8 *)atlas->pixels + y * atlas->pitch,
+            BITMAP_MAX * TILE_SIZE * 4, 1, fp) == 1;
+    if (fclose(fp) == 0 && ok)
     {
-        SDL_Delay(STANDARD_DELAY);
-        PrintText(" * Level %d * ", Game.current_level + 2, 
-            (int)(SCREEN_SIZE_X / 3), (int)(SCREEN_SIZE_Y - TILE_SIZE / 1.5));
-        SDL_RenderPresent(Renderer);
-        SDL_Delay(STANDARD_DELAY);
-        StartLevel(++Game.current_level);
+        remove(ATLAS_CACHE);
+        rename(ATLAS_CACHE ".tmp", ATLAS_CACHE);
     } else
-    {
-        PrintText("    Level  %2u", Game.current_level + 1, 
-            TILE_SIZE + X_MARGIN, 
-            (int)(SCREEN_SIZE_Y - TILE_SIZE / 1.5));
-        PrintText("   Diam  %3u", Game.diamonds, 
-            (int)(TILE_SIZE + SCREEN_SIZE_X / 3), 
-            (int)(SCREEN_SIZE_Y - TILE_SIZE / 1.5));
-        PrintText("Time  %3u", Game.time, 
-            (int)(TILE_SIZE + SCREEN_SIZE_X / 1.5), 
-            (int)(SCREEN_SIZE_Y - TILE_SIZE / 1.5));
-        PrintText("%c", (Game.sound_mode)?' ':'M', SCREEN_SIZE_X - TILE_SIZE, 
-            (int)(SCREEN_SIZE_Y - TILE_SIZE / 1.5));
-        SDL_RenderPresent(Renderer);
-    }
+        remove(ATLAS_CACHE ".tmp");
 }
 
 
-/**********************
- * Refreash the Board *
- **********************/
-void RefreashBoard(void)
+/********************************************
+ * Pack all the tiles into a single texture *
+ ********************************************/
+void LoadAtlas(SDL_Surface *atlas)
 {
-    static int t = 0;
+    int i;
 
-    if (!t--)
+    if (!atlas)
     {
-        CrashRemove();
-        MoveRocks();
-        MoveBoxes();
-        ShowStatus();
-        ShowView();
-        SoundPlay();
-        t = INTER_TIME / 5; // The speed of moving objects
-    }
-}
-
+        atlas = SDL_CreateRGBSurfaceWithFormat(0, BITMAP_MAX * TILE_SIZE,
+            TILE_SIZE, 32, SDL_PIXELFORMAT_RGBA8888);
+        if (!atlas)
+            exit(fprintf(stderr, "Could not create the tile atlas\n"));
 
-/*********************
- * Time decrementing *
- *********************/
-void DecrementTime(void)
-{
-    static int t = INTER_TIME;
+        for (i = 0; i < BITMAP_MAX; i++)
+        {
+            if (!Decoded[i])
+                exit(fprintf(stderr, "Could not load %s\n", BitmapFile[i]));
+            SDL_SetSurfaceBlendMode(Decoded[i], SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(Decoded[i], NULL, atlas,
+                &(SDL_Rect){i * TILE_SIZE, 0, TILE_SIZE, TILE_SIZE});
+            SDL_FreeSurface(Decoded[i]);
+            Decoded[i] = NULL;
+        }
+        SaveAtlasCache(atlas);
+    }
 
-    if (Game.time <= 0 || Game.hero_state == KILLED)
-        return;
+    Atlas = SDL_CreateTextureFromSurface(Renderer, atlas);
+    SDL_FreeSurface(atlas);
 
-    switch (t--)
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    // Two triangles per tile, the same for every batch
+    for (i = 0; i < BATCH_MAX; i++)
     {
-        case 0:
-            Game.time--;
-            t = INTER_TIME;
-        case INTER_TIME / 2:
-            if (Game.hero_state == FACE1 && Game.move_time - Game.time > 5)
-                Game.hero_state = FACE2;
-            else
-                Game.hero_state = FACE1;
+        int *p = &BatchIndex[i * 6];
+
+        p[0] = i * 4; p[1] = i * 4 + 1; p[2] = i * 4 + 2;
+        p[3] = i * 4; p[4] = i * 4 + 2; p[5] = i * 4 + 3;
     }
+#endif
 }
 
 
-/******************
- * Show the intro *
- ******************/
-void ShowIntro(void)
+/*************************************************
+ * Draw calls and input latency over the session *
+ *************************************************/
+void ShowStats(void)
 {
-    SDL_Texture *intro;
-
-    Surface = SDL_LoadBMP("res/intro.bmp");
-    intro = SDL_CreateTextureFromSurface(Renderer, Surface);
-    SDL_RenderCopy(Renderer, intro, NULL, &(SDL_Rect){0, 0, 
-        SCREEN_SIZE_X, SCREEN_SIZE_Y});
-    SDL_RenderPresent(Renderer);
-
-    SDL_Delay(STANDARD_DELAY * 2);
-    SDL_RenderClear(Renderer);
-    SDL_FreeSurface(Surface);
+    if (Frames)
+        printf("frames %ld draw_calls %ld per_frame %.1f\n",
+            Frames, DrawCalls, (double)DrawCalls / Frames);
+    if (Latencies)
+        printf("keys %ld input_to_present_ms min %u avg %.1f max %u\n",
+            Latencies, LatencyMin, (double)LatencySum / Latencies,
+            LatencyMax);
+    if (FirstFrameMs >= 0)
+        printf("startup_ms intro %.1f assets %.1f first_frame %.1f "
+            "atlas %s\n", IntroMs, AssetsMs, FirstFrameMs,
+            AtlasCached ? "cached" : "decoded");
+    AudioClose();
 }
 
 
@@ -715,7 +678,9 @@ void ShowIntro(void)
  ********************/
 void StartAplication(void)
 {
-    int i;
+    SDL_Thread *worker[DECODE_TASKS];
+    SDL_Surface *atlas;
+    int threads, i;
 
     SDL_Init(SDL_INIT_VIDEO);
     SDL_Window *win = SDL_CreateWindow("Boulder Palm on PC",
@@ -724,112 +689,400 @@ void StartAplication(void)
     SDL_Surface* icon = SDL_LoadBMP("res/app_icon.bmp");
     SDL_SetWindowIcon(win, icon);
     SDL_FreeSurface(icon);
-    Renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_PRESENTVSYNC);
+    Renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_PRESENTVSYNC
+        | SDL_RENDERER_TARGETTEXTURE);
+    if (!Renderer)
+        Renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_PRESENTVSYNC);
     if (!Renderer)
         exit(fprintf(stderr, "Could not create SDL Renderer\n"));
+    BoardCache = SDL_CreateTexture(Renderer, SDL_PIXELFORMAT_RGBA8888,
+        SDL_TEXTUREACCESS_TARGET, BOARD_WIDTH * TILE_SIZE,
+        BOARD_HIGH * TILE_SIZE);
 
     TTF_Init();
-    Font = TTF_OpenFont("res/font.ttf", TILE_SIZE / 2);
-
-    Game.current_level = 0;
-    Game.diamonds      = 0;
-    Game.move_mode     = REAL;
-    Game.sound_mode    = 1;
-    Game.sound_to_play = SOUND_NONE;
+    if (!NoIntro)
+        ShowIntro();
+
+    // The tiles unless the cache has them
+    atlas = LoadAtlasCache();
+    AtlasCached = atlas != NULL;
+    DecodeTasks = atlas ? 0 : DECODE_TASKS;
+    threads = SDL_GetCPUCount() < DecodeTasks ? SDL_GetCPUCount()
+        : DecodeTasks;
+    for (i = 0; i < threads; i++)
+        worker[i] = SDL_CreateThread(DecodeWorker, "decode", NULL);
+
+    // The tile rules, the built in ones when there is no file
+    if ((i = RulesLoad(RULES_FILE)) > 0)
+        exit(fprintf(stderr, "Bad rule in %s line %d\n", RULES_FILE, i));
+
+    // The first level meanwhile
+    if (PackOpenDefault(&Pack) == 0)
+        LevelPack = &Pack;
+    if (!Playback)
+        ReplayStart(&Replay, 0, (uint32_t)time(NULL));
+    WorldStart(&World, Replay.level, Replay.seed);
+    HistoryInit(&History, HISTORY_TICKS);
+    HistoryPush(&History, &World);
+
+    AudioOpen(); // Silent without a device
+
+    // The font here, no other thread calls SDL_ttf
+    RenderGlyphs();
+
+    // Whatever is left is done here, all of it if no thread started
+    WaitIntro();
+    DecodeWorker(NULL);
+    for (i = 0; i < threads; i++)
+        if (worker[i])
+            SDL_WaitThread(worker[i], NULL);
+    if (Font)
+        LoadGlyphs();
+    LoadAtlas(atlas);
+    AssetsMs = Elapsed();
+}
 
-    for (i = 0; i < BITMAP_MAX; i++)
-    {
-        Surface = SDL_LoadBMP(BitmapFile[i]);
-        Tiles[i] = SDL_CreateTextureFromSurface(Renderer, Surface);
-        SDL_FreeSurface(Surface);
-    }
 
-    ShowIntro();
-    StartLevel(Game.current_level);
+/**************************************
+ * Save the input log of this session *
+ **************************************/
+void SaveRecord(void)
+{
+    ReplayEnd(&Replay, &World);
+    if (ReplaySave(&Replay, RecordFile) < 0)
+        fprintf(stderr, "Could not save %s\n", RecordFile);
 }
 
 
 /*************************************
 * Handle a key press from the player *
  *************************************/
-void KeyDown(void)
+enum input KeyDown(void)
 {
     switch (Event.key.keysym.sym)
     {
         case SDLK_LEFT: case SDLK_a: 
-            MoveHero(0, -1);
-            Game.hero_state = LEFT;
-            break;
+            return INPUT_LEFT;
         case SDLK_RIGHT: case SDLK_d:
-            MoveHero(0, 1);
-            Game.hero_state = RIGHT;
-            break;
+            return INPUT_RIGHT;
         case SDLK_UP: case SDLK_w: 
-            MoveHero(-1, 0);
-            break;
+            return INPUT_UP;
         case SDLK_DOWN: case SDLK_s:
-            MoveHero(1, 0);
-            break;
+            return INPUT_DOWN;
         case SDLK_SPACE: case SDLK_RETURN:
-            if (Game.hero_state == KILLED)
-                StartLevel(Game.current_level);
-            else
-                Game.move_mode = GHOST;
-            break;
+            return INPUT_ACTION;
         case SDLK_m:
-            Game.sound_mode ^= 1;
-            break;
+            return INPUT_MUTE;
         case SDLK_n:
-            StartLevel(++Game.current_level);
-            break;
+            return INPUT_NEXT;
         case SDLK_p:
-            if (Game.current_level > 0)
-                StartLevel(--Game.current_level);
-            break;
+            return INPUT_PREV;
         case SDLK_r:
-            KillHero();
-            break;
+            return INPUT_RESTART;
         case SDLK_j: // Respawn cheat
-            SetBoard(Game.lastposy, Game.lastposx, HERO);
-            Game.hero_state = FACE1;
-            break;
+            return INPUT_RESPAWN;
         case SDLK_t: // Time cheat
-            Game.time = Game.level_time;
-            break;
+            return INPUT_TIME;
         case SDLK_q:
             exit(0);
     }
+
+    return INPUT_NONE;
 }
 
 
-/******************
- * Main game loop *
- ******************/
-int main()
+/*****************************************************
+ * Take all pending events, queue the keys for ticks *
+ *****************************************************/
+int DrainEvents(void)
 {
-    StartAplication();
+    enum input input;
+    int redraw = 0, tail;
 
-    for (;;)
+    while (SDL_PollEvent(&Event))
     {
-        if (SDL_PollEvent(&Event))
+        switch (Event.type)
         {
-            switch (Event.type)
-            {
-                case SDL_QUIT:
-                    exit(0);
-                case SDL_KEYDOWN:
-                    KeyDown();
+            case SDL_QUIT:
+                exit(0);
+            case SDL_KEYDOWN:
+                if (Event.key.keysym.sym == SDLK_BACKSPACE && !Playback)
+                    SDL_AtomicAdd(&Rewinds, 1);
+                input = KeyDown();
+                if (input == INPUT_NONE || Playback)
                     break;
-            }
+                tail = SDL_AtomicGet(&KeysTail);
+                if (tail - SDL_AtomicGet(&KeysHead) == INPUT_QUEUE)
+                    break; // Nobody can follow that many keys anyway
+                Keys[tail % INPUT_QUEUE] =
+                    (struct key){input, Event.key.timestamp};
+                SDL_AtomicSet(&KeysTail, tail + 1);
+                break;
+            case SDL_RENDER_TARGETS_RESET:
+                CacheGeneration = -1; // The cache lost its content
+                break;
+        }
+        redraw = 1;
+    }
 
-            ShowView();
-            SoundPlay();
+    return redraw;
+}
+
+
+/*******************************************************************
+ * Simulation thread: input for the next tick, one key at most; a *
+ * full ring of applied keys only costs their latency figures     *
+ *******************************************************************/
+enum input NextInput(void)
+{
+    struct key *key;
+    int head, tail;
+
+    if (Playback)
+        return ReplayInput(&Replay, World.tick);
+    head = SDL_AtomicGet(&KeysHead);
+    if (head == SDL_AtomicGet(&KeysTail))
+        return INPUT_NONE;
+
+    key = &Keys[head % INPUT_QUEUE];
+    tail = SDL_AtomicGet(&AppliedTail);
+    if (tail - SDL_AtomicGet(&AppliedHead) < INPUT_QUEUE)
+    {
+        Applied[tail % INPUT_QUEUE] = (struct applied){World.tick, key->time};
+        SDL_AtomicSet(&AppliedTail, tail + 1);
+    }
+    ReplayRecord(&Replay, World.tick, key->input);
+    SDL_AtomicSet(&KeysHead, head + 1);
+    return key->input;
+}
+
+
+/******************************************************************
+ * Back in time by the rewind key presses. The input log forgets  *
+ * the ticks undone, so a recording plays back the game as it was *
+ * finally played.                                                *
+ ******************************************************************/
+void Rewind(void)
+{
+    HistoryRewind(&History, &World,
+        SDL_AtomicSet(&Rewinds, 0) * REWIND_TICKS);
+    // Keys pressed before were meant for the time undone
+    SDL_AtomicSet(&KeysHead, SDL_AtomicGet(&KeysTail));
+    ReplayTruncate(&Replay, World.tick);
+}
+
+
+/*****************************************************************
+ * Simulation thread: the view and the status line of this tick *
+ * into the back frame, which then becomes the middle one        *
+ *****************************************************************/
+void Publish(int status)
+{
+    struct frame *f = &FrameBuffer[FrameBack];
+    int y, x, n, k;
+    const unsigned char *span;
+
+    f->tick = World.tick;
+    f->status = status;
+    f->game = World.game;
+    f->generation = World.generation;
+
+    ViewPlace(&World, &f->view);
+
+    // A chunk wide run of cells at a time
+    for (y = 0; y < f->view.high; y++)
+        for (x = 0; x < f->view.width; x += n)
+        {
+            span = BoardSpan(&World, f->view.starty + y, f->view.startx + x,
+                &n);
+            if (n > f->view.width - x)
+                n = f->view.width - x;
+            for (k = 0; k < n; k++)
+                f->tile[y][x + k] = span ? span[k] & 15 : World.fill;
         }
 
-        DecrementTime();
-        RefreashBoard();
+    // The frame is written before anyone can take it
+    SDL_MemoryBarrierRelease();
+    FrameBack = SDL_AtomicSet(&FrameMiddle, FrameBack | FRAME_FRESH)
+        & ~FRAME_FRESH;
+}
+
+// Main thread: the latest frame published, 0 if it is already shown
+int TakeFrame(void)
+{
+    if (!(SDL_AtomicGet(&FrameMiddle) & FRAME_FRESH))
+        return 0;
+    FrameFront = SDL_AtomicSet(&FrameMiddle, FrameFront) & ~FRAME_FRESH;
+    SDL_MemoryBarrierAcquire();
+    Shown = &FrameBuffer[FrameFront];
+    return 1;
+}
+
+
+/**************************************************
+ * The keys applied up to the frame shown are on *
+ * the screen now                                 *
+ **************************************************/
+void KeysPresented(void)
+{
+    Uint32 now = SDL_GetTicks(), ms;
+    int head = SDL_AtomicGet(&AppliedHead);
+
+    for (; head != SDL_AtomicGet(&AppliedTail)
+        && Applied[head % INPUT_QUEUE].tick < Shown->tick; head++)
+    {
+        ms = now - Applied[head % INPUT_QUEUE].time;
+        LatencySum += ms;
+        if (ms < LatencyMin)
+            LatencyMin = ms;
+        if (ms > LatencyMax)
+            LatencyMax = ms;
+        Latencies++;
+    }
+    SDL_AtomicSet(&AppliedHead, head);
+}
+
+
+// Simulation thread: a pause that is cut short by the end of the game
+void Pause(Uint32 ms)
+{
+    Uint32 start = SDL_GetTicks();
+
+    while (!SDL_AtomicGet(&Quit) && SDL_GetTicks() - start < ms)
+        SDL_Delay(10);
+}
+
+
+/******************************************************************
+ * Simulation thread: TICK_RATE ticks per second of real time,    *
+ * a frame published whenever something on the screen may change *
+ ******************************************************************/
+int Simulate(void *data)
+{
+    int events, status = 0, ticks, changed;
+    enum input input;
+    Uint64 step, last, now, lag = 0;
+
+    (void)data;
+    step = SDL_GetPerformanceFrequency() / TICK_RATE;
+    last = SDL_GetPerformanceCounter();
+    Publish(status);
 
-        SDL_Delay(1000 / 60);
+    while (!SDL_AtomicGet(&Quit))
+    {
+        now = SDL_GetPerformanceCounter();
+        lag += now - last;
+        last = now;
+        if (lag > step * MAX_CATCH_UP)
+            lag = step * MAX_CATCH_UP; // Too slow, let the game slow down
+
+        events = 0;
+        changed = SDL_AtomicGet(&Rewinds) > 0;
+        if (changed)
+            Rewind();
+
+        for (ticks = 0; lag >= step; ticks++)
+        {
+            lag -= step;
+            input = NextInput();
+            changed |= input != INPUT_NONE;
+            events |= WorldStep(&World, input);
+            if (!Playback)
+                HistoryPush(&History, &World);
+            if (events & WORLD_LEVEL_DONE)
+                break;
+        }
+        if (events & WORLD_PHYSICS)
+            status = events;
+
+        if (events & WORLD_LEVEL_DONE)
+        {
+            Pause(STANDARD_DELAY);
+            Publish(events);
+            Pause(STANDARD_DELAY);
+            status = 0;
+            lag = 0; // The pause is not game time
+            last = SDL_GetPerformanceCounter();
+            changed = 1;
+        }
+        if (changed || events & WORLD_PHYSICS)
+        {
+            PROFILE_BEGIN(PHASE_SOUND);
+            SoundPlay();
+            PROFILE_END(PHASE_SOUND);
+            Publish(status);
+        } else
+        if (!ticks)
+        {
+            // Nothing to do until the next tick is due
+            SDL_Delay((step - lag) * 1000 / SDL_GetPerformanceFrequency());
+        }
     }
+
+    return 0;
 }
 
+// Before anything else at exit: the world is left alone from then on
+void StopSimulation(void)
+{
+    SDL_AtomicSet(&Quit, 1);
+    SDL_WaitThread(Simulation, NULL);
+}
+
+
+/******************
+ * Main game loop *
+ ******************/
+int main(int argc, char **argv)
+{
+    int redraw, fresh, i;
+
+    StartCounter = SDL_GetPerformanceCounter();
+    for (i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-n"))
+            NoIntro = 1;
+        else
+        if (i + 1 < argc && !strcmp(argv[i], "-r") && !Playback)
+            RecordFile = argv[++i];
+        else
+        if (i + 1 < argc && !strcmp(argv[i], "-p") && !RecordFile)
+        {
+            if (ReplayLoad(&Replay, argv[++i]) < 0)
+                exit(fprintf(stderr, "Could not read %s\n", argv[i]));
+            Playback = 1;
+        } else
+            exit(fprintf(stderr,
+                "usage: boulder [-n] [-r record | -p replay]\n"));
+
+    StartAplication();
+    atexit(ShowStats);
+#ifdef PROFILE
+    atexit(ProfileExit);
+#endif
+    if (RecordFile)
+        atexit(SaveRecord);
+
+    // The world runs on its own thread, a VSync wait does not hold it up
+    SDL_AtomicSet(&FrameMiddle, 0);
+    Simulation = SDL_CreateThread(Simulate, "simulation", NULL);
+    if (!Simulation)
+        exit(fprintf(stderr, "Could not start the simulation thread\n"));
+    atexit(StopSimulation);
+
+    for (;;)
+    {
+        PROFILE_BEGIN(PHASE_EVENTS);
+        redraw = DrainEvents();
+        PROFILE_END(PHASE_EVENTS);
+
+        fresh = TakeFrame();
+        if (fresh || redraw)
+        {
+            ShowFrame();
+            if (fresh && FirstFrameMs < 0)
+                FirstFrameMs = Elapsed();
+            KeysPresented();
+        } else
+            SDL_Delay(1); // Nothing new from the simulation yet
+    }
+}
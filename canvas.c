@@ -0,0 +1,301 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ *
+ * The game screen without a window: the view around the hero and the
+ * status line, drawn by the CPU into plain RGBA memory, for the renderer
+ * and the benchmarks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "world.h"
+#include "canvas.h"
+
+/********************
+ * Global variables *
+ ********************/
+unsigned char Tile[BITMAP_MAX][TILE_SIZE][TILE_SIZE * 4];
+
+// The characters of the status line, 5x7, top row first, bit 4 leftmost.
+// The game uses res/font.ttf, which needs FreeType to be drawn.
+const char GlyphChar[] = "*0123456789DGLMOTaeilmrv";
+const unsigned char Glyph[][GLYPH_H] = {
+    {0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00},   // *
+    {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e},   // 0
+    {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e},
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f},
+    {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},
+    {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02},
+    {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e},
+    {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e},
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e},
+    {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c},   // 9
+    {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c},   // D
+    {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f},
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f},
+    {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11},
+    {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},
+    {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},   // T
+    {0x00, 0x00, 0x0e, 0x01, 0x0f, 0x11, 0x0f},   // a
+    {0x00, 0x00, 0x0e, 0x11, 0x1f, 0x10, 0x0e},
+    {0x04, 0x00, 0x0c, 0x04, 0x04, 0x04, 0x0e},
+    {0x0c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e},
+    {0x00, 0x00, 0x1a, 0x15, 0x15, 0x11, 0x11},
+    {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10},
+    {0x00, 0x00, 0x11, 0x11, 0x11, 0x0a, 0x04}};  // v
+const unsigned char TextColor[4] = {255, 0, 0, 255};
+
+
+/*****************************************************************
+ * Tile bitmaps: uncompressed BMP files of 1 to 32 bits a pixel, *
+ * scaled to TILE_SIZE by the nearest pixel as SDL_BlitScaled    *
+ *****************************************************************/
+static uint32_t Get32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int LoadBitmap(const char *path, unsigned char tile[TILE_SIZE][TILE_SIZE * 4])
+{
+    FILE *fp = fopen(path, "rb");
+    unsigned char *data, *p;
+    long size, palette, bits;
+    int32_t width, height;
+    uint32_t colors;
+    int bpp, stride, x, y, sx, sy, k;
+
+    if (fp == NULL)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    if (size < 54 || !(data = malloc(size)))
+    {
+        fclose(fp);
+        return -1;
+    }
+    if (fread(data, size, 1, fp) != 1)
+        size = 0;
+    fclose(fp);
+
+    // BITMAPINFOHEADER or a later one, no compression
+    width = Get32(data + 18);
+    height = Get32(data + 22);
+    bpp = data[28];
+    colors = Get32(data + 46) ? Get32(data + 46) : 1u << (bpp & 15);
+    palette = 14 + (long)Get32(data + 14);
+    bits = Get32(data + 10);
+    stride = (width * bpp + 31) / 32 * 4;
+    if (size < 54 || memcmp(data, "BM", 2) || Get32(data + 14) < 40
+        || Get32(data + 30) != 0 || width < 1 || width > 65536
+        || height == 0 || height > 65536 || height < -65536
+        || (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32)
+        || (bpp <= 8 && (colors > 256 || palette + colors * 4 > size))
+        || bits + (long)stride * abs(height) > size)
+    {
+        free(data);
+        return -1;
+    }
+
+    for (y = 0; y < TILE_SIZE; y++)
+    {
+        // Rows are stored bottom up unless the height is negative
+        sy = y * abs(height) / TILE_SIZE;
+        p = data + bits + (long)stride * (height > 0 ? height - 1 - sy : sy);
+        for (x = 0; x < TILE_SIZE; x++)
+        {
+            sx = x * width / TILE_SIZE;
+            if (bpp <= 8)
+            {
+                k = p[sx * bpp / 8] >> (8 - bpp - sx * bpp % 8)
+                    & ((1 << bpp) - 1);
+                k = palette + ((uint32_t)k < colors ? k : 0) * 4;
+                tile[y][x * 4] = data[k + 2];
+                tile[y][x * 4 + 1] = data[k + 1];
+                tile[y][x * 4 + 2] = data[k];
+            } else
+            {
+                tile[y][x * 4] = p[sx * bpp / 8 + 2];
+                tile[y][x * 4 + 1] = p[sx * bpp / 8 + 1];
+                tile[y][x * 4 + 2] = p[sx * bpp / 8];
+            }
+            tile[y][x * 4 + 3] = 255;
+        }
+    }
+
+    free(data);
+    return 0;
+}
+
+// Every tile bitmap, the path of the one that could not be read or NULL
+const char *CanvasLoad(void)
+{
+    int i;
+
+    for (i = 0; i < BITMAP_MAX; i++)
+        if (LoadBitmap(BitmapFile[i], Tile[i]) < 0)
+            return BitmapFile[i];
+    return NULL;
+}
+
+
+/*******************************************************
+ * Drawing: whole rows of a tile copied at a time, the *
+ * compiler turns the copy into SIMD loads and stores  *
+ *******************************************************/
+// Black, the first row pixel by pixel and the others copied from it
+static void Fill(struct canvas *canvas, int y, int h)
+{
+    unsigned char *p = canvas->pixels + y * PITCH;
+    int k;
+
+    for (k = 0; k < SCREEN_SIZE_X; k++)
+        memcpy(p + k * 4, "\0\0\0\377", 4);
+    for (k = 1; k < h; k++)
+        memcpy(p + k * PITCH, p, PITCH);
+}
+
+static void Blit(struct canvas *canvas, int t, int x, int y)
+{
+    unsigned char *p = canvas->pixels + y * PITCH + x * 4;
+    int k;
+
+    for (k = 0; k < TILE_SIZE; k++, p += PITCH)
+        memcpy(p, Tile[t][k], TILE_SIZE * 4);
+}
+
+static void Text(struct canvas *canvas, const char *text, int x, int y)
+{
+    const char *c;
+    unsigned char *p;
+    int g, j, i;
+
+    for (; *text && x + GLYPH_W * GLYPH_SCALE <= SCREEN_SIZE_X;
+         text++, x += (GLYPH_W + 1) * GLYPH_SCALE)
+    {
+        if (!(c = strchr(GlyphChar, *text)))
+            continue;
+        g = c - GlyphChar;
+        for (j = 0; j < GLYPH_H * GLYPH_SCALE; j++)
+            for (i = 0; i < GLYPH_W * GLYPH_SCALE; i++)
+                if (Glyph[g][j / GLYPH_SCALE] >> (GLYPH_W - 1
+                    - i / GLYPH_SCALE) & 1)
+                {
+                    p = canvas->pixels + (y + j) * PITCH + (x + i) * 4;
+                    memcpy(p, TextColor, 4);
+                }
+    }
+}
+
+
+/****************************************************************
+ * The view around the hero, as the game publishes and draws it *
+ ****************************************************************/
+void DrawView(struct canvas *canvas, struct world *world)
+{
+    const unsigned char *span;
+    struct view v;
+    int full, hero, x, y, n, k, t;
+
+    ViewPlace(world, &v);
+
+    // A new board or a scroll makes every cell stale
+    full = v.startx != canvas->startx || v.starty != canvas->starty
+        || world->generation != canvas->generation;
+    if (full && (v.width < BOARD_WIDTH || v.high < BOARD_HIGH))
+        Fill(canvas, 0, STATUS_Y);
+
+    // The changed cells only; the hero sprite changes on its own too
+    hero = world->game.hero_state != canvas->hero;
+    for (y = 0; y < v.high; y++)
+        for (x = 0; x < v.width; x += n)
+        {
+            span = BoardSpan(world, v.starty + y, v.startx + x, &n);
+            if (n > v.width - x)
+                n = v.width - x;
+            for (k = 0; k < n; k++)
+            {
+                t = span ? span[k] & 15 : world->fill;
+                if (full || t != canvas->drawn[y][x + k]
+                    || (hero && t == HERO))
+                {
+                    Blit(canvas, SelectTile(t, world->game.hero_state),
+                        (x + k) * TILE_SIZE + X_MARGIN,
+                        y * TILE_SIZE + Y_MARGIN);
+                    canvas->drawn[y][x + k] = t;
+                }
+            }
+        }
+
+    canvas->startx = v.startx;
+    canvas->starty = v.starty;
+    canvas->generation = world->generation;
+    canvas->hero = world->game.hero_state;
+}
+
+
+/******************************************************
+ * Time, score, etc and the end of the Game state, as *
+ * ShowStatus in boulder.c; drawn when a text changes *
+ ******************************************************/
+void DrawStatus(struct canvas *canvas, struct world *world, int events)
+{
+    static const int x[4] = {LEVEL_X, DIAMONDS_X, TIME_X, MUTE_X};
+    char text[4][32] = {"", "", "", ""};
+    int k;
+
+    if (events & WORLD_GAME_OVER)
+        snprintf(text[0], sizeof(text[0]), " * Game Over * ");
+    else
+    if (events & WORLD_LEVEL_DONE)
+        snprintf(text[0], sizeof(text[0]), " * Level %d * ",
+            world->game.current_level + 1);
+    else
+    {
+        snprintf(text[0], sizeof(text[0]), "    Level  %2u",
+            world->game.current_level + 1);
+        snprintf(text[1], sizeof(text[1]), "   Diam  %3u",
+            world->game.diamonds);
+        snprintf(text[2], sizeof(text[2]), "Time  %3u", world->game.time);
+        snprintf(text[3], sizeof(text[3]), "%c",
+            world->game.sound_mode ? ' ' : 'M');
+    }
+    if (!memcmp(text, canvas->status, sizeof(text)))
+        return;
+
+    Fill(canvas, STATUS_Y, SCREEN_SIZE_Y - STATUS_Y);
+    // The end of the game is written a third of the way across
+    if (events & (WORLD_GAME_OVER | WORLD_LEVEL_DONE))
+        Text(canvas, text[0], END_X, TEXT_Y);
+    else
+        for (k = 0; k < 4; k++)
+            Text(canvas, text[k], x[k], TEXT_Y);
+    memcpy(canvas->status, text, sizeof(text));
+}
+
+// The world is already on the next level, the screen is not yet
+void Draw(struct canvas *canvas, struct world *world, int events)
+{
+    if (!(events & WORLD_LEVEL_DONE))
+        DrawView(canvas, world);
+    DrawStatus(canvas, world, events);
+}
+
+void CanvasInit(struct canvas *canvas)
+{
+    memset(canvas, 0, sizeof(*canvas));
+    if (!(canvas->pixels = malloc(FRAME_BYTES)))
+        exit(fprintf(stderr, "Out of memory\n"));
+    canvas->generation = -1;
+    canvas->status[0][0] = 1; // No text, drawn the first time
+    Fill(canvas, 0, SCREEN_SIZE_Y);
+}
+
+void CanvasFree(struct canvas *canvas)
+{
+    free(canvas->pixels);
+    canvas->pixels = NULL;
+}
@@ -0,0 +1,41 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include "world.h"
+#include "screen.h"
+
+#define PITCH               (SCREEN_SIZE_X * 4)
+#define FRAME_BYTES         (SCREEN_SIZE_Y * PITCH)
+#define GLYPH_W             5
+#define GLYPH_H             7
+#define GLYPH_SCALE         2     // About the size of the game's font
+
+/*
+ * The game screen drawn by the CPU into plain RGBA memory, as boulder.c
+ * draws it into the window. Only what changed since the last frame is
+ * drawn again, as the game does with its board cache.
+ */
+struct canvas
+{
+    unsigned char *pixels;  // SCREEN_SIZE_Y rows of PITCH bytes, RGBA
+    int startx, starty;     // View drawn last
+    int generation;         // Of the board drawn, -1 for none
+    enum hero hero;
+    unsigned char drawn[BOARD_HIGH][BOARD_WIDTH];
+    char status[4][32];     // Texts of the status line drawn
+};
+
+int LoadBitmap(const char *path, unsigned char tile[TILE_SIZE][TILE_SIZE * 4]);
+const char *CanvasLoad(void);
+void CanvasInit(struct canvas *canvas);
+void CanvasFree(struct canvas *canvas);
+void DrawView(struct canvas *canvas, struct world *world);
+void DrawStatus(struct canvas *canvas, struct world *world, int events);
+void Draw(struct canvas *canvas, struct world *world, int events);
+
+#endif
@@ -0,0 +1,869 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ *
+ * Fuzzer of the game rules: random levels, broken ones on purpose (short
+ * lines, missing borders, stray characters), played with random keys on
+ * all cores, the invariants checked after every tick that changes the
+ * board. A case that breaks one is shrunk to a small level and replay.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "world.h"
+#include "rules.h"
+#include "pool.h"
+#include "replay.h"
+#include "sweep.h"
+#include "tools.h"
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+#define CASES               20000
+#define CASE_TICKS          3000
+#define WIDTH_MAX           90    // Some past the bitboard engine's 64
+#define HEIGHT_MAX          32
+#define MUTATIONS           8     // At most, on a level from res/
+#define SHRINK_PASSES       8
+#define CRASH_STATUS        100   // Exit status of a shrink child, plus
+                                  // the failure
+
+enum failure {PASSED, HEROES, LOST_HERO, DIAMONDS, CRASHED, FAILURES};
+
+// One run: the level as text, as LoadLevelFile reads it, and the keys
+struct fuzz_case
+{
+    char *text;
+    size_t size, alloc;
+    uint32_t seed;        // World random numbers
+    enum physics physics;
+    unsigned char *keys;  // enum input of each tick
+    long ticks;
+};
+
+/********************
+ * Global variables *
+ ********************/
+const char *FailureName[FAILURES] = {"passed", "heroes", "lost_hero",
+    "diamonds", "crashed"};
+const char *Prefix = "fuzz";
+long Cases = CASES;
+long CaseTicks = CASE_TICKS;
+uint32_t Seed = 1;
+char **Bases;             // Texts of the levels mutated
+int BaseCount;
+
+atomic_long NextCase;
+atomic_long Ticks;
+atomic_long Failures[FAILURES];
+atomic_long First[FAILURES]; // Lowest case number of each failure
+
+_Thread_local struct fuzz_case *Current; // Saved if a sanitizer stops us
+
+
+/***************************************************************
+ * Random numbers of a case, the same for the same case number *
+ ***************************************************************/
+uint32_t Random(uint64_t *s)
+{
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ull);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (z ^ (z >> 31)) >> 32;
+}
+
+
+/*****************************************
+ * Level text, grown and cut one byte at *
+ * a time                                *
+ *****************************************/
+void TextInsert(struct fuzz_case *fc, size_t pos, const char *s, size_t n)
+{
+    if (fc->size + n + 1 > fc->alloc)
+    {
+        fc->alloc = (fc->size + n + 1) * 2;
+        if (!(fc->text = realloc(fc->text, fc->alloc)))
+            exit(fprintf(stderr, "Out of memory\n"));
+    }
+    memmove(fc->text + pos + n, fc->text + pos, fc->size - pos);
+    memcpy(fc->text + pos, s, n);
+    fc->size += n;
+    fc->text[fc->size] = 0;
+}
+
+void TextAdd(struct fuzz_case *fc, const char *s)
+{
+    TextInsert(fc, fc->size, s, strlen(s));
+}
+
+void TextCut(struct fuzz_case *fc, size_t pos, size_t n)
+{
+    memmove(fc->text + pos, fc->text + pos + n, fc->size - pos - n);
+    fc->size -= n;
+    fc->text[fc->size] = 0;
+}
+
+// Start of the line holding pos, and its length with the '\n'
+size_t LineAt(struct fuzz_case *fc, size_t pos, size_t *n)
+{
+    size_t start = pos, end = pos;
+
+    while (start > 0 && fc->text[start - 1] != '\n')
+        start--;
+    while (end < fc->size && fc->text[end++] != '\n')
+        ;
+    *n = end - start;
+    return start;
+}
+
+// The line from its start pos, in memory of its own
+char *LineCopy(struct fuzz_case *fc, size_t pos, size_t *n)
+{
+    char *line;
+
+    LineAt(fc, pos, n);
+    if (!(line = malloc(*n)))
+        exit(fprintf(stderr, "Out of memory\n"));
+    memcpy(line, fc->text + pos, *n);
+    return line;
+}
+
+
+/************************************************************
+ * A cell of a level: mostly tunnel and ground, sometimes a *
+ * character the level format does not know. Never a hero.  *
+ ************************************************************/
+char RandomCell(uint64_t *s)
+{
+    static const char cells[] = "000000555555333344411716789:";
+    uint32_t r = Random(s);
+    char c;
+
+    if (r % 32)
+        return cells[r / 32 % (sizeof(cells) - 1)];
+    do
+        c = ' ' + Random(s) % 95;
+    while (((c - '0') & 15) == HERO);
+    return c;
+}
+
+// A level made up from nothing, one hero in it
+void RandomLevel(struct fuzz_case *fc, uint64_t *s)
+{
+    char line[WIDTH_MAX + 3];
+    int width, height, border, len, hy, hx, j, i;
+
+    width = 3 + Random(s) % (Random(s) % 4 ? 40 : WIDTH_MAX - 2);
+    height = 3 + Random(s) % (HEIGHT_MAX - 2);
+    border = Random(s) % 4 ? 15 : Random(s) % 16; // Top right bottom left
+    hy = 1 + Random(s) % (height - 2);
+    hx = 1 + Random(s) % (width - 2);
+
+    if (Random(s) % 4)
+    {
+        snprintf(line, sizeof(line), ".d=%d\n", (int)(Random(s) % 12));
+        TextAdd(fc, line);
+    }
+    snprintf(line, sizeof(line), ".t=%d\n", 1 + (int)(Random(s) % 300));
+    TextAdd(fc, line);
+    if (!(Random(s) % 8))
+    {
+        snprintf(line, sizeof(line), ".%c=%d\n", "whf"[Random(s) % 3],
+            (int)(Random(s) % (WIDTH_MAX + 8)) - 4);
+        TextAdd(fc, line);
+    }
+
+    for (j = 0; j < height; j++)
+    {
+        len = Random(s) % 4 ? width : (int)(Random(s) % (width + 1));
+        for (i = 0; i < len; i++)
+            if ((j == 0 && (border & 1)) || (i == width - 1 && (border & 2))
+                || (j == height - 1 && (border & 4))
+                || (i == 0 && (border & 8)))
+                line[i] = '6';
+            else
+                line[i] = j == hy && i == hx ? '2' : RandomCell(s);
+        if (!(Random(s) % 16))
+            line[i++] = '\r';
+        line[i++] = '\n';
+        TextInsert(fc, fc->size, line, i);
+    }
+}
+
+// One of the levels given, broken in a few places
+void MutateLevel(struct fuzz_case *fc, uint64_t *s)
+{
+    char c, head[16], *line;
+    size_t pos, n, start;
+    int k, count = 1 + Random(s) % MUTATIONS;
+
+    TextAdd(fc, Bases[Random(s) % BaseCount]);
+    for (k = 0; k < count && fc->size; k++)
+    {
+        pos = Random(s) % fc->size;
+        c = RandomCell(s);
+        switch (Random(s) % 8)
+        {
+            case 0: TextCut(fc, pos, 1); break;
+            case 1: fc->text[pos] = c; break;
+            case 2: TextInsert(fc, pos, &c, 1); break;
+            case 3: // Short line
+                start = LineAt(fc, pos, &n);
+                TextCut(fc, pos, start + n - pos - 1);
+                break;
+            case 4:
+                start = LineAt(fc, pos, &n);
+                TextCut(fc, start, n);
+                break;
+            case 5:
+                start = LineAt(fc, pos, &n);
+                line = LineCopy(fc, start, &n);
+                TextInsert(fc, start, line, n);
+                free(line);
+                break;
+            case 6: // No left border
+                for (pos = 0; pos < fc->size; pos = start + n)
+                {
+                    start = LineAt(fc, pos, &n);
+                    if (n > 1 && fc->text[start] != '.'
+                        && fc->text[start] != '#')
+                    {
+                        TextCut(fc, start, 1);
+                        n--;
+                    }
+                }
+                break;
+            case 7:
+                snprintf(head, sizeof(head), ".%c=%d\n", "dtwhf"[pos % 5],
+                    (int)(Random(s) % (WIDTH_MAX + 8)) - 4);
+                TextInsert(fc, 0, head, strlen(head));
+                break;
+        }
+    }
+}
+
+// Case number n of this run
+void Generate(struct fuzz_case *fc, long n)
+{
+    uint64_t s = (uint64_t)Seed << 32 ^ n;
+    long t;
+
+    fc->size = 0;
+    TextAdd(fc, "");
+    if (BaseCount && Random(&s) % 2)
+        MutateLevel(fc, &s);
+    else
+        RandomLevel(fc, &s);
+    fc->seed = Random(&s);
+    fc->physics = n % 2 ? PHYSICS_BITBOARD : PHYSICS_SCALAR;
+
+    // A key on about every other tick; ACTION before a move digs
+    if (!(fc->keys = realloc(fc->keys, CaseTicks)))
+        exit(fprintf(stderr, "Out of memory\n"));
+    fc->ticks = CaseTicks;
+    for (t = 0; t < fc->ticks; t++)
+        fc->keys[t] = Random(&s) % 2 ? INPUT_NONE
+            : INPUT_LEFT + Random(&s) % (INPUT_ACTION - INPUT_LEFT + 1);
+}
+
+void CaseFree(struct fuzz_case *fc)
+{
+    free(fc->text);
+    free(fc->keys);
+    memset(fc, 0, sizeof(*fc));
+}
+
+
+/******************************************************
+ * Heroes and diamonds on the whole board, the border *
+ * included, and the heroes inside it                 *
+ ******************************************************/
+struct census
+{
+    int heroes, inner, diamonds;
+};
+
+void Count(struct world *world, struct census *census)
+{
+    const unsigned char *span;
+    uint32_t cells, heroes;
+    int h, w, n;
+
+    memset(census, 0, sizeof(*census));
+    for (h = 0; h < world->height; h++)
+        for (w = 0; w < world->width; w += n)
+        {
+            // A chunk wide run of cells at a time
+            span = BoardSpan(world, h, w, &n);
+            if (!span)
+            {
+                // Fill only, never a hero (see BoardResize)
+                census->diamonds += world->fill == DIAMOND ? n : 0;
+                continue;
+            }
+            cells = n < CHUNK_SIZE ? ((uint32_t)1 << n) - 1 : ~(uint32_t)0;
+            heroes = SweepMatch(span, HERO) & cells;
+            census->heroes += __builtin_popcount(heroes);
+            census->diamonds += __builtin_popcount(SweepMatch(span, DIAMOND)
+                & cells);
+
+            if (h == 0 || h == world->height - 1)
+                continue;
+            if (w == 0)
+                heroes &= ~(uint32_t)1;
+            if (w + n == world->width)
+                heroes &= ~((uint32_t)1 << (n - 1));
+            census->inner += __builtin_popcount(heroes);
+        }
+}
+
+
+/*****************************************************************
+ * Play the case and check it after every tick:                  *
+ *   heroes     no tick makes a second hero                      *
+ *   lost_hero  the rules know of every hero inside the border,  *
+ *              none gets onto the border, out of their sight    *
+ *   diamonds   only a pick up or an explosion changes the count *
+ *              of diamonds, the diamonds left drop by the ones  *
+ *              picked up                                        *
+ * *tick is the tick that failed, or the ticks played.           *
+ *****************************************************************/
+enum failure Play(struct fuzz_case *fc, struct world *world, long *tick)
+{
+    FILE *fp;
+    struct census last, now;
+    int loaded, most, left, picked, events;
+    uint64_t hash;
+
+    WorldInit(world);
+    WorldSeed(world, fc->seed);
+    *tick = 0;
+    if (!fc->size)
+        return PASSED; // Nothing to play
+    if (!(fp = fmemopen(fc->text, fc->size, "r")))
+        exit(fprintf(stderr, "Out of memory\n"));
+    loaded = LoadLevelStream(world, fp) == 0;
+    fclose(fp);
+    if (!loaded)
+        return PASSED;
+
+    // The way StartLevel starts a level
+    world->physics = fc->physics;
+    world->game.time = world->game.level_time;
+    world->game.move_time = world->game.level_time;
+    world->game.diamonds = world->game.level_diamonds;
+    world->game.hero_state = FACE1;
+    TrackHero(world);
+    Count(world, &last);
+    most = last.heroes > 1 ? last.heroes : 1;
+
+    for (; *tick < fc->ticks && world->game.hero_state != KILLED; ++*tick)
+    {
+        hash = world->hash;
+        left = world->game.diamonds;
+        world->sounds = 0;
+        events = WorldStep(world, fc->keys[*tick]);
+        if (events & WORLD_LEVEL_DONE)
+            break; // The next level is one from res/
+
+        picked = world->sounds >> SOUND_DIAMOND & 1;
+        if (world->game.diamonds != (left && picked ? left - 1 : left))
+            return DIAMONDS;
+        if (world->hash == hash)
+            continue; // No cell changed
+
+        Count(world, &now);
+        if (now.heroes > most)
+            return HEROES;
+        if (now.inner != world->entities[ENTITY_HERO].count
+            || now.heroes - now.inner > last.heroes - last.inner)
+            return LOST_HERO;
+        if (!(world->sounds >> SOUND_EXPLOSION & 1)
+            && now.diamonds != last.diamonds - picked)
+            return DIAMONDS;
+        last = now;
+        if (events & WORLD_GAME_OVER)
+            break;
+    }
+
+    return PASSED;
+}
+
+
+/***************************************************************
+ * Shrink: a change is kept while the case fails the same way. *
+ * Each try runs in a child process, so a case that crashes    *
+ * can be shrunk as well.                                      *
+ ***************************************************************/
+enum failure Try(struct fuzz_case *fc)
+{
+    struct world world;
+    enum failure failure;
+    long tick;
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+        exit(fprintf(stderr, "Could not fork\n"));
+    if (pid == 0)
+    {
+        failure = Play(fc, &world, &tick);
+        _exit(failure ? CRASH_STATUS + failure : 0);
+    }
+
+    if (waitpid(pid, &status, 0) != pid)
+        exit(fprintf(stderr, "Could not wait for a child\n"));
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        return PASSED;
+    if (WIFEXITED(status) && WEXITSTATUS(status) > CRASH_STATUS
+        && WEXITSTATUS(status) < CRASH_STATUS + CRASHED)
+        return WEXITSTATUS(status) - CRASH_STATUS;
+    return CRASHED; // By a signal or a sanitizer
+}
+
+// No ticks past the one that fails
+void Truncate(struct fuzz_case *fc, enum failure failure)
+{
+    struct world world;
+    long tick;
+
+    if (failure == CRASHED)
+        return; // Not safe in this process
+    if (Play(fc, &world, &tick) == failure)
+        fc->ticks = tick + 1;
+    WorldFree(&world);
+}
+
+int ShrinkKeys(struct fuzz_case *fc, enum failure failure)
+{
+    unsigned char *keys;
+    long n, k, ticks;
+    int progress = 0;
+
+    if (!(keys = malloc(fc->ticks + 1)))
+        exit(fprintf(stderr, "Out of memory\n"));
+
+    // Runs of ticks cut out, from half of them down to one
+    for (n = fc->ticks / 2; n >= 1; n /= 2)
+        for (k = 0; k + n <= fc->ticks;)
+        {
+            memcpy(keys, fc->keys, fc->ticks);
+            ticks = fc->ticks;
+            memmove(fc->keys + k, fc->keys + k + n, fc->ticks - k - n);
+            fc->ticks -= n;
+            if (Try(fc) == failure)
+                progress = 1;
+            else
+            {
+                memcpy(fc->keys, keys, ticks);
+                fc->ticks = ticks;
+                k += n;
+            }
+        }
+
+    // The keys left turned into waits
+    for (k = 0; k < fc->ticks; k++)
+        if (fc->keys[k] != INPUT_NONE)
+        {
+            n = fc->keys[k];
+            fc->keys[k] = INPUT_NONE;
+            if (Try(fc) == failure)
+                progress = 1;
+            else
+                fc->keys[k] = n;
+        }
+
+    free(keys);
+    return progress;
+}
+
+int ShrinkLevel(struct fuzz_case *fc, enum failure failure)
+{
+    size_t pos, n;
+    char c, *line;
+    int progress = 0;
+
+    // Whole lines first
+    for (pos = 0; pos < fc->size;)
+    {
+        line = LineCopy(fc, pos, &n);
+        TextCut(fc, pos, n);
+        if (Try(fc) == failure)
+            progress = 1;
+        else
+        {
+            TextInsert(fc, pos, line, n);
+            pos += n;
+        }
+        free(line);
+    }
+
+    // Then each cell: gone, or else a tunnel
+    for (pos = 0; pos < fc->size; pos++)
+    {
+        if ((c = fc->text[pos]) == '\n')
+            continue;
+        TextCut(fc, pos, 1);
+        if (Try(fc) == failure)
+        {
+            progress = 1;
+            pos--;
+            continue;
+        }
+        TextInsert(fc, pos, "0", 1);
+        if (c != '0' && Try(fc) == failure)
+            progress = 1;
+        else
+            fc->text[pos] = c;
+    }
+
+    return progress;
+}
+
+void Shrink(struct fuzz_case *fc, enum failure failure)
+{
+    int pass, progress = 1;
+
+    Truncate(fc, failure);
+    for (pass = 0; pass < SHRINK_PASSES && progress; pass++)
+    {
+        progress = ShrinkKeys(fc, failure);
+        progress |= ShrinkLevel(fc, failure);
+        Truncate(fc, failure);
+    }
+}
+
+
+/*****************************************************************
+ * A case on disk: name.lvl, the level with a comment on top the *
+ * game skips, and name.rpl, the keys (level -1, it is the file) *
+ *****************************************************************/
+int SaveCase(struct fuzz_case *fc, const char *name, enum failure failure,
+    uint32_t checksum)
+{
+    struct replay replay;
+    char path[PATH_MAX];
+    FILE *fp;
+    long t;
+    int ok;
+
+    snprintf(path, sizeof(path), "%s.lvl", name);
+    if (!(fp = fopen(path, "w")))
+        return -1;
+    fprintf(fp, "# fuzz physics %s failure %s\n",
+        fc->physics == PHYSICS_BITBOARD ? "bitboard" : "scalar",
+        FailureName[failure]);
+    ok = fwrite(fc->text, 1, fc->size, fp) == fc->size;
+    if (fclose(fp) || !ok)
+        return -1;
+
+    ReplayStart(&replay, -1, fc->seed);
+    for (t = 0; t < fc->ticks; t++)
+        if (fc->keys[t] != INPUT_NONE)
+            ReplayRecord(&replay, t, fc->keys[t]);
+    replay.end = fc->ticks;
+    replay.checksum = checksum;
+    snprintf(path, sizeof(path), "%s.rpl", name);
+    ok = ReplaySave(&replay, path);
+    ReplayFree(&replay);
+    return ok;
+}
+
+int LoadCase(struct fuzz_case *fc, const char *name, uint32_t *checksum)
+{
+    struct replay replay;
+    char path[PATH_MAX], buf[4096];
+    size_t n, pos;
+    FILE *fp;
+    long t;
+
+    memset(fc, 0, sizeof(*fc));
+    snprintf(path, sizeof(path), "%s.rpl", name);
+    if (ReplayLoad(&replay, path) < 0)
+        return -1;
+    fc->seed = replay.seed;
+    fc->ticks = replay.end;
+    *checksum = replay.checksum;
+    if (!(fc->keys = malloc(fc->ticks + 1)))
+        exit(fprintf(stderr, "Out of memory\n"));
+    for (t = 0; t < fc->ticks; t++)
+        fc->keys[t] = ReplayInput(&replay, t);
+    ReplayFree(&replay);
+
+    snprintf(path, sizeof(path), "%s.lvl", name);
+    if (!(fp = fopen(path, "r")))
+        return -1;
+    TextAdd(fc, "");
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        TextInsert(fc, fc->size, buf, n);
+    fclose(fp);
+
+    // The comment SaveCase wrote goes, the engine it names stays
+    if (!strncmp(fc->text, "# fuzz ", 7))
+    {
+        fc->physics = strstr(fc->text, "physics bitboard") == fc->text + 7
+            ? PHYSICS_BITBOARD : PHYSICS_SCALAR;
+        pos = LineAt(fc, 0, &n);
+        TextCut(fc, pos, n);
+    }
+    return 0;
+}
+
+
+#ifdef __SANITIZE_ADDRESS__
+/**********************************************************
+ * A sanitizer stops the fuzzer: save the case it was on, *
+ * for fuzz -p and fuzz -m                                *
+ **********************************************************/
+void Died(void)
+{
+    char name[PATH_MAX];
+
+    if (!Current)
+        return;
+    snprintf(name, sizeof(name), "%s-crashed", Prefix);
+    if (SaveCase(Current, name, CRASHED, 0) == 0)
+        fprintf(stderr, "Case saved to %s.lvl and %s.rpl\n", name, name);
+}
+#endif
+
+
+/************************************************
+ * Worker: cases from the shared counter, until *
+ * all are taken                                *
+ ************************************************/
+void Fuzz(struct task *task, struct worker *worker)
+{
+    struct fuzz_case fc = {0};
+    struct world world;
+    enum failure failure;
+    long n, tick, ticks = 0, first;
+
+    (void)task;
+    (void)worker;
+    Current = &fc;
+
+    while ((n = atomic_fetch_add(&NextCase, 1)) < Cases)
+    {
+        Generate(&fc, n);
+        failure = Play(&fc, &world, &tick);
+        WorldFree(&world);
+        ticks += tick;
+        if (failure == PASSED)
+            continue;
+
+        atomic_fetch_add(&Failures[failure], 1);
+        first = atomic_load(&First[failure]);
+        while (n < first
+            && !atomic_compare_exchange_weak(&First[failure], &first, n))
+            ;
+    }
+
+    Current = NULL;
+    atomic_fetch_add(&Ticks, ticks);
+    CaseFree(&fc);
+}
+
+
+/*******************************************************
+ * Shrink the first case of a failure and save it as   *
+ * name, or name.lvl and name.rpl shrunk into name-min *
+ *******************************************************/
+void Minimize(struct fuzz_case *fc, enum failure failure, const char *name)
+{
+    struct world world;
+    uint32_t checksum = 0;
+    long tick, keys = 0, t;
+
+    Shrink(fc, failure);
+    if (failure != CRASHED)
+    {
+        Play(fc, &world, &tick);
+        checksum = WorldChecksum(&world);
+        WorldFree(&world);
+    }
+
+    for (t = 0; t < fc->ticks; t++)
+        keys += fc->keys[t] != INPUT_NONE;
+    if (SaveCase(fc, name, failure, checksum) < 0)
+        exit(fprintf(stderr, "Could not write %s\n", name));
+    printf("%s shrunk to %zu bytes of level, %ld ticks, %ld keys: "
+        "%s.lvl %s.rpl\n", FailureName[failure], fc->size, fc->ticks, keys,
+        name, name);
+}
+
+
+/*********************************************
+ * Levels to mutate: the files given, or the *
+ * shipped ones                              *
+ *********************************************/
+void AddBase(const char *path)
+{
+    struct fuzz_case fc = {0};
+    char buf[4096];
+    size_t n;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r")))
+        exit(fprintf(stderr, "Could not read %s\n", path));
+    TextAdd(&fc, "");
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        TextInsert(&fc, fc.size, buf, n);
+    fclose(fp);
+
+    if (!(Bases = realloc(Bases, (BaseCount + 1) * sizeof(char *))))
+        exit(fprintf(stderr, "Out of memory\n"));
+    Bases[BaseCount++] = fc.text;
+}
+
+int IsFile(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+
+    if (fp)
+        fclose(fp);
+    return fp != NULL;
+}
+
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: fuzz [-n cases] [-j threads] [-t ticks] [-r seed]\n"
+        "            [-o prefix] [file.lvl ...]\n"
+        "       fuzz -p case  (play case.lvl with case.rpl, checked)\n"
+        "       fuzz -m case  (shrink them into case-min.lvl and .rpl)\n"
+        "       exit status 0 no failure, 1 some\n");
+    exit(2);
+}
+
+
+/********
+ * Main *
+ ********/
+int main(int argc, char **argv)
+{
+    const char *play = NULL, *shrink = NULL;
+    struct fuzz_case fc;
+    struct world world;
+    struct task *tasks, **list;
+    char path[PATH_MAX];
+    enum failure failure;
+    uint32_t checksum;
+    int threads = 0, status = 0, opt, i;
+    long tick;
+    double start, elapsed;
+
+    while ((opt = getopt(argc, argv, "n:j:t:r:o:p:m:")) != -1)
+        switch (opt)
+        {
+            case 'n': Cases = atol(optarg); break;
+            case 'j': threads = atoi(optarg); break;
+            case 't': CaseTicks = atol(optarg); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            case 'o': Prefix = optarg; break;
+            case 'p': play = optarg; break;
+            case 'm': shrink = optarg; break;
+            default: Usage();
+        }
+    if (Cases < 1 || CaseTicks < 1)
+        Usage();
+    if (threads < 1)
+        threads = PoolThreads();
+#ifdef __SANITIZE_ADDRESS__
+    __sanitizer_set_death_callback(Died);
+#endif
+
+    // The tile rules, the built in ones when there is no file
+    if ((i = RulesLoad(RULES_FILE)) > 0)
+        exit(fprintf(stderr, "Bad rule in %s line %d\n", RULES_FILE, i));
+
+    // A saved case played here, or shrunk with each try in a child
+    if (play)
+    {
+        if (LoadCase(&fc, play, &checksum) < 0)
+            exit(fprintf(stderr, "Could not read %s.lvl and %s.rpl\n",
+                play, play));
+        failure = Play(&fc, &world, &tick);
+        printf("case %s %s at tick %ld checksum %s\n", play,
+            FailureName[failure], tick,
+            WorldChecksum(&world) == checksum ? "identical" : "differs");
+        WorldFree(&world);
+        CaseFree(&fc);
+        return failure != PASSED;
+    }
+    if (shrink)
+    {
+        if (LoadCase(&fc, shrink, &checksum) < 0)
+            exit(fprintf(stderr, "Could not read %s.lvl and %s.rpl\n",
+                shrink, shrink));
+        failure = Try(&fc);
+        printf("case %s %s\n", shrink, FailureName[failure]);
+        snprintf(path, sizeof(path), "%s-min", shrink);
+        if (failure != PASSED)
+            Minimize(&fc, failure, path);
+        CaseFree(&fc);
+        return failure != PASSED;
+    }
+
+    for (i = optind; i < argc; i++)
+        AddBase(argv[i]);
+    for (i = 1; optind == argc; i++)
+    {
+        snprintf(path, sizeof(path), "res/%d.lvl", i);
+        if (!IsFile(path))
+            break;
+        AddBase(path);
+    }
+
+    for (i = 0; i < FAILURES; i++)
+        atomic_store(&First[i], LONG_MAX);
+    tasks = calloc(threads, sizeof(struct task));
+    list = calloc(threads, sizeof(struct task *));
+    if (!tasks || !list)
+        exit(fprintf(stderr, "Out of memory\n"));
+    for (i = 0; i < threads; i++)
+    {
+        tasks[i].run = Fuzz;
+        list[i] = &tasks[i];
+    }
+
+    start = Seconds();
+    PoolRun(list, threads, threads, NULL);
+    elapsed = Seconds() - start;
+
+    printf("cases %ld threads %d levels %d ticks %ld seconds %.3f "
+        "ticks/s %.0f\n", Cases, threads, BaseCount, atomic_load(&Ticks),
+        elapsed, atomic_load(&Ticks) / elapsed);
+    printf("failures");
+    for (i = PASSED + 1; i < CRASHED; i++)
+        printf(" %s %ld", FailureName[i], atomic_load(&Failures[i]));
+    printf("\n");
+
+    // The first case of each failure, as small as it gets
+    for (i = PASSED + 1; i < CRASHED; i++)
+        if (atomic_load(&First[i]) != LONG_MAX)
+        {
+            memset(&fc, 0, sizeof(fc));
+            Generate(&fc, atomic_load(&First[i]));
+            snprintf(path, sizeof(path), "%s-%s", Prefix, FailureName[i]);
+            printf("case %ld fails %s\n", atomic_load(&First[i]),
+                FailureName[i]);
+            Minimize(&fc, i, path);
+            CaseFree(&fc);
+            status = 1;
+        }
+
+    free(list);
+    free(tasks);
+    return status;
+}
@@ -0,0 +1,93 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "history.h"
+
+
+static struct snapshot *Nth(struct history *history, int n)
+{
+    return &history->ring[(history->first + n) % history->size];
+}
+
+void HistoryInit(struct history *history, int size)
+{
+    history->size = size > 0 ? size : 1;
+    history->first = history->count = 0;
+    history->pages = 0;
+    if (!(history->ring = calloc(history->size, sizeof(struct snapshot))))
+        exit(fprintf(stderr, "Out of memory\n"));
+}
+
+
+/*****************************************************
+ * Snapshot of the world as it is now, after a step, *
+ * and the same after a level change                 *
+ *****************************************************/
+void HistoryPush(struct history *history, struct world *world)
+{
+    struct snapshot *prev = NULL;
+
+    if (history->count == history->size)
+    {
+        history->pages -= SnapshotFree(Nth(history, 0));
+        history->first = (history->first + 1) % history->size;
+        history->count--;
+    }
+    if (history->count)
+        prev = Nth(history, history->count - 1);
+    history->pages += SnapshotTake(world, Nth(history, history->count),
+        prev);
+    history->count++;
+}
+
+
+/******************************************************************
+ * Back by ticks snapshots, as far as the history goes; the later *
+ * ones are dropped, the game goes on from there. Returns the     *
+ * number of ticks gone back.                                     *
+ ******************************************************************/
+int HistoryRewind(struct history *history, struct world *world, int ticks)
+{
+    int back;
+
+    if (!history->count)
+        return 0;
+    back = ticks < history->count - 1 ? ticks : history->count - 1;
+    while (back-- > 0)
+    {
+        history->pages -= SnapshotFree(Nth(history, history->count - 1));
+        history->count--;
+    }
+    back = world->tick - Nth(history, history->count - 1)->tick;
+    SnapshotLoad(world, Nth(history, history->count - 1));
+    return back;
+}
+
+size_t HistoryBytes(struct history *history)
+{
+    size_t bytes = history->size * sizeof(struct snapshot)
+        + history->pages * sizeof(struct page);
+    int n;
+
+    for (n = 0; n < history->count; n++)
+        bytes += ((Nth(history, n)->width + CHUNK_MASK) >> CHUNK_BITS)
+            * ((Nth(history, n)->height + CHUNK_MASK) >> CHUNK_BITS)
+            * sizeof(struct page *);
+    return bytes;
+}
+
+void HistoryFree(struct history *history)
+{
+    while (history->count)
+    {
+        SnapshotFree(Nth(history, history->count - 1));
+        history->count--;
+    }
+    free(history->ring);
+    history->ring = NULL;
+    history->pages = 0;
+}
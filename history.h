@@ -0,0 +1,34 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include "world.h"
+
+// Ticks kept by the game: five minutes
+#define HISTORY_TICKS       (60 * 60 * 5)
+
+/*
+ * The last ticks of a world, one snapshot each, oldest dropped first.
+ * Snapshots share the pages of the chunks that did not change, so the
+ * memory grows with what happens on the board, not with its size.
+ */
+struct history
+{
+    struct snapshot *ring;
+    int size;             // Snapshots kept at most
+    int first, count;
+    long pages;           // Pages owned by the snapshots
+};
+
+void HistoryInit(struct history *history, int size);
+void HistoryPush(struct history *history, struct world *world);
+int HistoryRewind(struct history *history, struct world *world, int ticks);
+size_t HistoryBytes(struct history *history);
+void HistoryFree(struct history *history);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ *
+ * Level pack builder: compiles .lvl files into one pack (see pack.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "world.h"
+#include "pack.h"
+
+struct entry
+{
+    size_t cells;         // Offset in Cells
+    int width, height, fill, diamonds, time;
+};
+
+/********************
+ * Global variables *
+ ********************/
+struct entry *Entries;
+int Count;
+unsigned char *Cells;     // Cells of all levels, nibble packed
+size_t CellsSize, CellsAlloc;
+
+
+/*********************************************
+ * Add the loaded level to the pack to write *
+ *********************************************/
+void AddLevel(struct world *world)
+{
+    size_t need = ((size_t)world->width * world->height + 1) / 2, k = 0;
+    struct entry *e;
+    int i, j;
+
+    if (!(Entries = realloc(Entries, (Count + 1) * sizeof(struct entry))))
+        exit(fprintf(stderr, "Out of memory\n"));
+    e = &Entries[Count++];
+    *e = (struct entry){CellsSize, world->width, world->height, world->fill,
+        world->game.level_diamonds, world->game.level_time};
+
+    while (CellsSize + need > CellsAlloc)
+    {
+        CellsAlloc = CellsAlloc ? CellsAlloc * 2 : 65536;
+        if (!(Cells = realloc(Cells, CellsAlloc)))
+            exit(fprintf(stderr, "Out of memory\n"));
+    }
+    memset(Cells + CellsSize, 0, need);
+
+    for (j = 0; j < world->height; j++)
+        for (i = 0; i < world->width; i++, k++)
+            Cells[CellsSize + (k >> 1)] |=
+                (GetBoard(world, j, i) & 15) << ((k & 1) << 2);
+
+    CellsSize += need;
+}
+
+
+/******************
+ * Write the pack *
+ ******************/
+int WritePack(const char *path)
+{
+    unsigned char header[PACK_HEADER] = {'B', 'P', 'L', 'P', PACK_VERSION};
+    unsigned char entry[PACK_ENTRY];
+    size_t base = PACK_HEADER + (size_t)Count * PACK_ENTRY;
+    FILE *fp;
+    int i, ok;
+
+    fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+
+    PackPut32(header + 8, Count);
+    ok = fwrite(header, sizeof(header), 1, fp) == 1;
+
+    // Cells follow the index
+    for (i = 0; ok && i < Count; i++)
+    {
+        PackPut32(entry, base + Entries[i].cells);
+        PackPut32(entry + 4, Entries[i].width);
+        PackPut32(entry + 8, Entries[i].height);
+        PackPut32(entry + 12, Entries[i].fill);
+        PackPut32(entry + 16, Entries[i].diamonds);
+        PackPut32(entry + 20, Entries[i].time);
+        ok = fwrite(entry, sizeof(entry), 1, fp) == 1;
+    }
+    ok = ok && fwrite(Cells, 1, CellsSize, fp) == CellsSize;
+
+    return (fclose(fp) == 0 && ok) ? 0 : -1;
+}
+
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: mkpack [-o pack] [level.lvl ...]\n"
+        "       without files takes res/1.lvl, res/2.lvl, ... in order\n");
+    exit(1);
+}
+
+
+/********
+ * Main *
+ ********/
+int main(int argc, char **argv)
+{
+    const char *out = LEVEL_PACK;
+    struct world world;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1)
+        switch (opt)
+        {
+            case 'o': out = optarg; break;
+            default: Usage();
+        }
+
+    WorldInit(&world);
+    if (optind < argc)
+    {
+        for (i = optind; i < argc; i++)
+        {
+            if (LoadLevelFile(&world, argv[i]) < 0)
+                exit(fprintf(stderr, "Could not read %s\n", argv[i]));
+            AddLevel(&world);
+        }
+    } else
+    {
+        for (i = 0; LoadLevel(&world, i) == 0; i++)
+            AddLevel(&world);
+    }
+    WorldFree(&world);
+
+    if (!Count)
+        exit(fprintf(stderr, "No levels\n"));
+    if (WritePack(out) < 0)
+        exit(fprintf(stderr, "Could not write %s\n", out));
+
+    printf("%s: %d levels, %zu bytes\n", out, Count,
+        PACK_HEADER + (size_t)Count * PACK_ENTRY + CellsSize);
+    return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "pack.h"
+
+struct pack *LevelPack;
+
+
+/*****************
+ * Little endian *
+ *****************/
+void PackPut32(unsigned char *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t Get32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/****************************
+ * Map the file into memory *
+ ****************************/
+#ifndef _WIN32
+static int PackMap(struct pack *pack, const char *path)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < PACK_HEADER)
+    {
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+
+    pack->data = p;
+    pack->size = st.st_size;
+    pack->mapped = 1;
+    return 0;
+}
+#else
+// No mmap here, read the file in one go
+static int PackMap(struct pack *pack, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    unsigned char *data = NULL;
+    long size;
+
+    if (!fp)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < PACK_HEADER || !(data = malloc(size))
+        || fread(data, 1, size, fp) != (size_t)size)
+    {
+        free(data);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    pack->data = data;
+    pack->size = size;
+    return 0;
+}
+#endif
+
+
+/*************************************
+ * Open the pack and check the index *
+ *************************************/
+int PackOpen(struct pack *pack, const char *path)
+{
+    const unsigned char *e;
+    uint64_t cells;
+    int i;
+
+    memset(pack, 0, sizeof(*pack));
+    if (PackMap(pack, path) < 0)
+        return -1;
+
+    if (memcmp(pack->data, "BPLP", 4) || pack->data[4] != PACK_VERSION)
+    {
+        PackClose(pack);
+        return -1;
+    }
+    pack->count = Get32(pack->data + 8);
+
+    // Every level must be inside the file, nothing is checked later
+    if ((uint64_t)pack->count * PACK_ENTRY > pack->size - PACK_HEADER)
+    {
+        PackClose(pack);
+        return -1;
+    }
+    for (i = 0; i < pack->count; i++)
+    {
+        e = pack->data + PACK_HEADER + i * PACK_ENTRY;
+        cells = (uint64_t)Get32(e + 4) * Get32(e + 8);
+        if (Get32(e + 4) < 1 || Get32(e + 4) > LEVELS_MAX
+            || Get32(e + 8) < 1 || Get32(e + 8) > LEVELS_MAX
+            || Get32(e) > pack->size
+            || (cells + 1) / 2 > pack->size - Get32(e))
+        {
+            PackClose(pack);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+// Time of the last change, to the nanosecond where the system keeps it
+static double Modified(const struct stat *st)
+{
+#if defined(_WIN32) || defined(__APPLE__)
+    return st->st_mtime;
+#else
+    return st->st_mtim.tv_sec + st->st_mtim.tv_nsec / 1e9;
+#endif
+}
+
+/*****************************************************************
+ * LEVEL_PACK, as long as it holds the levels of the .lvl files: *
+ * refused when one of them is newer, or there are more or fewer *
+ * of them, so an edited level is played before make runs again  *
+ *****************************************************************/
+int PackOpenDefault(struct pack *pack)
+{
+    struct stat built, level;
+    char path[32];
+    int n, stale = 0;
+
+    if (stat(LEVEL_PACK, &built) < 0 || PackOpen(pack, LEVEL_PACK) < 0)
+        return -1;
+    for (n = 0; ; n++)
+    {
+        snprintf(path, sizeof(path), LEVEL_FILE, n + 1);
+        if (stat(path, &level) < 0)
+            break;
+        stale |= Modified(&level) >= Modified(&built);
+    }
+
+    // Without any .lvl file the pack is all there is
+    if (n && (stale || n != pack->count))
+    {
+        fprintf(stderr, "%s is older than the .lvl files, reading those "
+            "(make rebuilds it)\n", LEVEL_PACK);
+        PackClose(pack);
+        return -1;
+    }
+    return 0;
+}
+
+
+void PackClose(struct pack *pack)
+{
+#ifndef _WIN32
+    if (pack->mapped)
+        munmap((void *)pack->data, pack->size);
+    else
+#endif
+        free((void *)pack->data);
+    memset(pack, 0, sizeof(*pack));
+}
+
+
+/******************************************
+ * Put one level of the pack on the board *
+ ******************************************/
+int PackLoad(struct pack *pack, struct world *world, int level)
+{
+    const unsigned char *e, *cells;
+    int width, height, fill, i, j, v;
+    size_t k = 0;
+
+    if (level < 0 || level >= pack->count)
+        return -1;
+
+    e = pack->data + PACK_HEADER + level * PACK_ENTRY;
+    cells = pack->data + Get32(e);
+    width = Get32(e + 4);
+    height = Get32(e + 8);
+    fill = Get32(e + 12);
+    world->game.level_diamonds = Get32(e + 16);
+    world->game.level_time = Get32(e + 20);
+
+    if (BoardResize(world, width, height, fill) < 0)
+        return -1;
+
+    // Cells holding the fill tile are there already
+    for (j = 0; j < height; j++)
+        for (i = 0; i < width; i++, k++)
+        {
+            v = cells[k >> 1] >> ((k & 1) << 2) & 15;
+            if (v != world->fill)
+                BoardPut(world, j, i, v);
+        }
+    BoardSettle(world);
+
+    return 0;
+}
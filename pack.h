@@ -0,0 +1,44 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include "world.h"
+
+#define LEVEL_PACK          "res/levels.pak"
+#define LEVEL_FILE          "res/%d.lvl" // Level n, from 1, without a pack
+
+/*
+ * All levels in one file, built by mkpack from the .lvl files.
+ * On disk (little endian):
+ *   "BPLP", u8 version, 3 x u8 zero, u32 count, u32 zero
+ *   index: count x (u32 offset, u32 width, u32 height, u32 fill,
+ *                   u32 diamonds, u32 time)
+ *   cells: width * height nibbles per level, row by row, low nibble first
+ */
+#define PACK_VERSION        1
+#define PACK_HEADER         16
+#define PACK_ENTRY          24
+
+struct pack
+{
+    const unsigned char *data; // The whole file, mapped read only
+    size_t size;
+    int count;            // Levels in the pack
+    int mapped;           // data comes from mmap, not malloc
+};
+
+// Pack used by LoadLevel instead of the .lvl files, NULL for none
+extern struct pack *LevelPack;
+
+int PackOpen(struct pack *pack, const char *path);
+int PackOpenDefault(struct pack *pack);
+void PackClose(struct pack *pack);
+int PackLoad(struct pack *pack, struct world *world, int level);
+void PackPut32(unsigned char *p, uint32_t v);
+
+#endif
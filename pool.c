@@ -0,0 +1,336 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "pool.h"
+
+#define DEQUE_MIN           1024
+#define IDLE_SPINS          64    // Empty rounds before a worker sleeps
+
+/*
+ * Chase-Lev deque: the owner pushes and takes at the bottom, thieves
+ * steal from the top. Fixed size, a full deque runs new tasks inline.
+ */
+struct deque
+{
+    atomic_long top;
+    atomic_long bottom;
+    long mask;
+    _Atomic(struct task *) *buf;
+};
+
+struct worker
+{
+    struct deque deque;
+    struct pool *pool;
+    pthread_t thread;
+    int started;          // thread runs and is to be joined
+    int id;
+    unsigned seed;        // Victim selection
+    long tasks, steals;
+};
+
+struct pool
+{
+    struct worker *workers;
+    int count;
+    atomic_long pending;  // Tasks submitted but not finished yet
+    atomic_int sleepers;  // Workers waiting on wake
+    pthread_mutex_t lock;
+    pthread_cond_t wake;  // New task, or all done
+};
+
+
+/**************************
+ * Deque owner operations *
+ **************************/
+static int DequePush(struct deque *d, struct task *task)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if (b - t > d->mask)
+        return 0;
+
+    atomic_store_explicit(&d->buf[b & d->mask], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+static struct task *DequeTake(struct deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    long t;
+    struct task *task = NULL;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (t <= b)
+    {
+        task = atomic_load_explicit(&d->buf[b & d->mask],
+            memory_order_relaxed);
+        if (t == b)
+        {
+            // Last task, race against thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed))
+                task = NULL;
+            atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        }
+    } else
+    {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+
+/*************************
+ * Deque thief operation *
+ *************************/
+static struct task *DequeSteal(struct deque *d)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b;
+    struct task *task;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (t >= b)
+        return NULL;
+
+    task = atomic_load_explicit(&d->buf[t & d->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+        memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+
+    return task;
+}
+
+
+/*******************************************
+ * Run the task and account for its ending *
+ *******************************************/
+static void RunTask(struct worker *worker, struct task *task)
+{
+    struct pool *pool = worker->pool;
+
+    task->run(task, worker);
+    worker->tasks++;
+    if (atomic_fetch_sub(&pool->pending, 1) == 1
+        && atomic_load(&pool->sleepers))
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+/*****************************************
+ * Try to steal work from random victims *
+ *****************************************/
+static struct task *StealTask(struct worker *worker)
+{
+    struct pool *pool = worker->pool;
+    struct task *task;
+    int i, v;
+
+    for (i = 0; i < pool->count; i++)
+    {
+        worker->seed = worker->seed * 1103515245 + 12345;
+        v = (worker->seed >> 16) % pool->count;
+        if (v == worker->id)
+            continue;
+        task = DequeSteal(&pool->workers[v].deque);
+        if (task)
+        {
+            worker->steals++;
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+
+/****************************************************************
+ * Nothing found for a while: sleep until a task is spawned or   *
+ * all are done. Counted as a sleeper before the last look at    *
+ * the deques, so a spawn either is seen here or wakes it up.    *
+ ****************************************************************/
+static struct task *Sleep(struct worker *worker)
+{
+    struct pool *pool = worker->pool;
+    struct task *task = NULL;
+    int v;
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->sleepers, 1);
+    for (v = 0; v < pool->count && !task; v++)
+        if (v != worker->id)
+            task = DequeSteal(&pool->workers[v].deque);
+    if (task)
+        worker->steals++;
+    else
+        if (atomic_load(&pool->pending) > 0)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+    atomic_fetch_sub(&pool->sleepers, 1);
+    pthread_mutex_unlock(&pool->lock);
+
+    return task;
+}
+
+
+/********************
+ * Worker main loop *
+ ********************/
+static void *WorkerLoop(void *arg)
+{
+    struct worker *worker = arg;
+    struct task *task;
+    int idle = 0;
+
+    while (atomic_load_explicit(&worker->pool->pending,
+        memory_order_acquire) > 0)
+    {
+        task = DequeTake(&worker->deque);
+        if (!task)
+            task = StealTask(worker);
+        if (!task && ++idle > IDLE_SPINS)
+            task = Sleep(worker);
+        if (task)
+        {
+            RunTask(worker, task);
+            idle = 0;
+        } else
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+
+/******************************************
+ * Queue a new task on the current worker *
+ ******************************************/
+void PoolSpawn(struct worker *worker, struct task *task)
+{
+    struct pool *pool = worker->pool;
+
+    atomic_fetch_add_explicit(&pool->pending, 1, memory_order_relaxed);
+    if (!DequePush(&worker->deque, task))
+    {
+        RunTask(worker, task);
+        return;
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&pool->sleepers))
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+int PoolWorkerId(struct worker *worker)
+{
+    return worker->id;
+}
+
+
+/*****************************
+ * Number of available cores *
+ *****************************/
+int PoolThreads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+
+/************************************************
+ * Spread the tasks over the threads and run it *
+ ************************************************/
+int PoolRun(struct task **tasks, int count, int threads,
+    struct pool_stats *stats)
+{
+    struct pool pool;
+    long size = DEQUE_MIN;
+    int i;
+
+    if (threads < 1)
+        threads = PoolThreads();
+    while (size < count / threads + 1)
+        size *= 2;
+
+    pool.count = threads;
+    pool.workers = calloc(threads, sizeof(struct worker));
+    if (!pool.workers)
+        return -1;
+    atomic_init(&pool.pending, count);
+    atomic_init(&pool.sleepers, 0);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+
+    for (i = 0; i < threads; i++)
+    {
+        struct worker *worker = &pool.workers[i];
+
+        worker->pool = &pool;
+        worker->id = i;
+        worker->seed = i * 2654435761u + 1;
+        worker->deque.mask = size - 1;
+        worker->deque.buf = calloc(size, sizeof(*worker->deque.buf));
+        if (!worker->deque.buf)
+            exit(fprintf(stderr, "Out of memory\n"));
+        atomic_init(&worker->deque.top, 0);
+        atomic_init(&worker->deque.bottom, 0);
+    }
+
+    // Initial round-robin deal, threads are not running yet
+    for (i = 0; i < count; i++)
+        DequePush(&pool.workers[i % threads].deque, tasks[i]);
+
+    // Tasks dealt to a thread that did not start are stolen by the others
+    for (i = 1; i < threads; i++)
+        pool.workers[i].started = pthread_create(&pool.workers[i].thread,
+            NULL, WorkerLoop, &pool.workers[i]) == 0;
+    WorkerLoop(&pool.workers[0]);
+    for (i = 1; i < threads; i++)
+        if (pool.workers[i].started)
+            pthread_join(pool.workers[i].thread, NULL);
+
+    if (stats)
+    {
+        stats->tasks = stats->steals = 0;
+        for (i = 0; i < threads; i++)
+        {
+            stats->tasks += pool.workers[i].tasks;
+            stats->steals += pool.workers[i].steals;
+        }
+    }
+
+    for (i = 0; i < threads; i++)
+        free(pool.workers[i].deque.buf);
+    free(pool.workers);
+    pthread_cond_destroy(&pool.wake);
+    pthread_mutex_destroy(&pool.lock);
+    return 0;
+}
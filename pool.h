@@ -0,0 +1,34 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+struct worker;
+
+/*
+ * A unit of work. The memory belongs to the caller and must stay valid
+ * until PoolRun returns; run may spawn more tasks on its own worker.
+ */
+struct task
+{
+    void (*run)(struct task *task, struct worker *worker);
+    void *arg;
+};
+
+struct pool_stats
+{
+    long tasks;           // Tasks run
+    long steals;          // Tasks taken from another worker's deque
+};
+
+/* Runs all tasks (and everything they spawn) on threads, returns when done */
+int PoolRun(struct task **tasks, int count, int threads,
+    struct pool_stats *stats);
+void PoolSpawn(struct worker *worker, struct task *task);
+int PoolWorkerId(struct worker *worker);
+int PoolThreads(void);
+
+#endif
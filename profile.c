@@ -0,0 +1,224 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include "profile.h"
+
+#ifdef PROFILE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define BUCKETS             160 // 4 per power of two, up to 2^40 ns
+
+struct event
+{
+    uint64_t begin;       // ns, CLOCK_MONOTONIC
+    uint32_t ns;
+    uint32_t phase;
+};
+
+/*
+ * Everything one thread measured. Only the thread itself writes it, the
+ * count is published last so ProfileWrite reads whole events.
+ */
+struct thread
+{
+    struct thread *next;
+    int id;
+    uint64_t open[PHASES]; // Begin of the phase running now
+    atomic_ulong count;   // Events so far, the ring holds the last ones
+    struct event ring[PROFILE_EVENTS];
+    uint64_t hist[PHASES][BUCKETS];
+    uint64_t total[PHASES], max[PHASES];
+};
+
+static const char *PhaseName[PHASES] = {"step", "input", "crashes", "rocks",
+    "boxes", "events", "frame", "view", "status", "present", "sound"};
+
+static _Atomic(struct thread *) Threads;
+static atomic_int ThreadCount;
+static _Thread_local struct thread *Self;
+
+
+static uint64_t Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+// The calling thread's buffer, made and linked in on first use
+static struct thread *Thread(void)
+{
+    struct thread *t;
+
+    if (Self)
+        return Self;
+    if (!(t = calloc(1, sizeof(struct thread))))
+        exit(fprintf(stderr, "Out of memory\n"));
+    t->id = atomic_fetch_add(&ThreadCount, 1);
+    t->next = atomic_load(&Threads);
+    while (!atomic_compare_exchange_weak(&Threads, &t->next, t))
+        ;
+    return Self = t;
+}
+
+
+/********************************************************
+ * Histogram bucket: 4 per power of two, ~20% wide each *
+ ********************************************************/
+static int Bucket(uint64_t ns)
+{
+    int e;
+
+    if (ns < 4)
+        return ns;
+    e = 63 - __builtin_clzll(ns);
+    return e > 40 ? BUCKETS - 1 : (e - 1) * 4 + (ns >> (e - 2) & 3);
+}
+
+// Upper end of bucket b in ns
+static uint64_t BucketTop(int b)
+{
+    if (b < 4)
+        return b + 1;
+    return (uint64_t)(4 + b % 4 + 1) << (b / 4 - 1);
+}
+
+
+/*****************************
+ * Called around every phase *
+ *****************************/
+void ProfileBegin(enum phase phase)
+{
+    Thread()->open[phase] = Now();
+}
+
+void ProfileEnd(enum phase phase)
+{
+    struct thread *t = Thread();
+    unsigned long n = atomic_load_explicit(&t->count, memory_order_relaxed);
+    uint64_t ns = Now() - t->open[phase];
+
+    t->ring[n % PROFILE_EVENTS] = (struct event){t->open[phase], ns, phase};
+    atomic_store_explicit(&t->count, n + 1, memory_order_release);
+
+    t->hist[phase][Bucket(ns)]++;
+    t->total[phase] += ns;
+    if (ns > t->max[phase])
+        t->max[phase] = ns;
+}
+
+
+/****************************************************************
+ * Chrome trace_event JSON (chrome://tracing, ui.perfetto.dev): *
+ * one complete event per phase, one track per thread           *
+ ****************************************************************/
+int ProfileWrite(const char *path)
+{
+    struct thread *t;
+    struct event *e;
+    unsigned long n, i;
+    uint64_t start = ~(uint64_t)0;
+    FILE *fp = fopen(path, "w");
+    int ok;
+
+    if (!fp)
+        return -1;
+
+    // Times from the first event kept
+    for (t = atomic_load(&Threads); t; t = t->next)
+    {
+        n = atomic_load_explicit(&t->count, memory_order_acquire);
+        i = n > PROFILE_EVENTS ? n - PROFILE_EVENTS : 0;
+        if (i < n && t->ring[i % PROFILE_EVENTS].begin < start)
+            start = t->ring[i % PROFILE_EVENTS].begin;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (t = atomic_load(&Threads); t; t = t->next)
+    {
+        fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}},\n", t->id, t->id);
+        n = atomic_load_explicit(&t->count, memory_order_acquire);
+        for (i = n > PROFILE_EVENTS ? n - PROFILE_EVENTS : 0; i < n; i++)
+        {
+            e = &t->ring[i % PROFILE_EVENTS];
+            fprintf(fp, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d},\n",
+                PhaseName[e->phase], e->phase < PHASE_EVENTS ? "world"
+                : "frame", (e->begin - start) / 1e3, e->ns / 1e3, t->id);
+        }
+    }
+    // JSON has no trailing comma, the last entry is the process name
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+        "\"args\":{\"name\":\"boulder\"}}\n]}\n");
+
+    ok = !ferror(fp);
+    return (fclose(fp) == 0 && ok) ? 0 : -1;
+}
+
+
+/*******************************************************************
+ * Latency of every phase over the whole run, all threads together *
+ *******************************************************************/
+void ProfileReport(FILE *fp)
+{
+    struct thread *t;
+    uint64_t hist[BUCKETS], count, total, max, seen;
+    int phase, b;
+    double p50, p99;
+
+    fprintf(fp, "%-8s %10s %10s %10s %10s %10s\n", "phase", "count",
+        "avg_us", "p50_us", "p99_us", "max_us");
+    for (phase = 0; phase < PHASES; phase++)
+    {
+        count = total = max = 0;
+        for (b = 0; b < BUCKETS; b++)
+            hist[b] = 0;
+        for (t = atomic_load(&Threads); t; t = t->next)
+        {
+            for (b = 0; b < BUCKETS; b++)
+            {
+                hist[b] += t->hist[phase][b];
+                count += t->hist[phase][b];
+            }
+            total += t->total[phase];
+            if (t->max[phase] > max)
+                max = t->max[phase];
+        }
+        if (!count)
+            continue;
+
+        // Upper ends of the buckets the percentiles fall into
+        p50 = p99 = 0;
+        for (b = 0, seen = 0; b < BUCKETS; b++)
+        {
+            seen += hist[b];
+            if (!p50 && seen * 2 >= count)
+                p50 = BucketTop(b) / 1e3;
+            if (!p99 && seen * 100 >= count * 99)
+                p99 = BucketTop(b) / 1e3;
+        }
+        fprintf(fp, "%-8s %10llu %10.2f %10.2f %10.2f %10.2f\n",
+            PhaseName[phase], (unsigned long long)count,
+            total / 1e3 / count, p50, p99, max / 1e3);
+    }
+}
+
+// Trace to $PROFILE_TRACE (trace.json by default), report to stderr
+void ProfileExit(void)
+{
+    const char *path = getenv("PROFILE_TRACE");
+
+    if (!path)
+        path = PROFILE_TRACE;
+    if (ProfileWrite(path) < 0)
+        fprintf(stderr, "Could not write %s\n", path);
+    ProfileReport(stderr);
+}
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+/*
+ * Phases of a tick and of a frame, timed when built with -DPROFILE.
+ * Without it PROFILE_BEGIN and PROFILE_END are nothing at all.
+ */
+enum phase {PHASE_STEP, PHASE_INPUT, PHASE_CRASHES, PHASE_ROCKS,
+            PHASE_BOXES, PHASE_EVENTS, PHASE_FRAME, PHASE_VIEW,
+            PHASE_STATUS, PHASE_PRESENT, PHASE_SOUND, PHASES};
+
+#ifdef PROFILE
+#define PROFILE_BEGIN(phase) ProfileBegin(phase)
+#define PROFILE_END(phase)   ProfileEnd(phase)
+
+// Events kept per thread, the last ones; the histograms count them all
+#define PROFILE_EVENTS      (1 << 16)
+#define PROFILE_TRACE       "trace.json"
+
+void ProfileBegin(enum phase phase);
+void ProfileEnd(enum phase phase);
+int ProfileWrite(const char *path);
+void ProfileReport(FILE *fp);
+void ProfileExit(void);
+#else
+#define PROFILE_BEGIN(phase) ((void)0)
+#define PROFILE_END(phase)   ((void)0)
+#endif
+
+#endif
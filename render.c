@@ -0,0 +1,388 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ *
+ * Renderer without a window: the game screen as boulder.c draws it, the
+ * view around the hero and the status line, drawn by the CPU into plain
+ * RGBA memory. Thumbnails of levels as PNG files on all cores, or every
+ * tick of a replay as a raw RGBA stream or PNG files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "world.h"
+#include "pool.h"
+#include "replay.h"
+#include "pack.h"
+#include "rules.h"
+#include "canvas.h"
+#include "tools.h"
+
+#define TICK_RATE           INTER_TIME
+#define ENCODE_FRAMES       64    // Frames of a replay compressed at once
+#define PNG_LEVEL           1     // zlib level, speed before size
+
+// A PNG file to write, one task each
+struct png
+{
+    struct task task;
+    const char *name;       // Level number or .lvl file, for thumbnails
+    char path[4096];
+    unsigned char *pixels;
+    int result;
+};
+
+/********************
+ * Global variables *
+ ********************/
+const char *Prefix = "level-";
+int ZlibLevel = PNG_LEVEL;
+struct pack Pack;
+
+
+/*************************************************************
+ * PNG: every row filtered by the one above (the tiles are   *
+ * scaled up, so most rows repeat), deflated at a fast level *
+ *************************************************************/
+static void Put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int Chunk(FILE *fp, const char *type, const unsigned char *data,
+    uint32_t n)
+{
+    unsigned char b[4];
+    uint32_t crc = crc32(crc32(0, (const Bytef *)type, 4), data, n);
+
+    Put32(b, n);
+    if (fwrite(b, 4, 1, fp) != 1 || fwrite(type, 4, 1, fp) != 1
+        || (n && fwrite(data, n, 1, fp) != 1))
+        return -1;
+    Put32(b, crc);
+    return fwrite(b, 4, 1, fp) == 1 ? 0 : -1;
+}
+
+int WritePng(const char *path, const unsigned char *pixels)
+{
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r',
+        '\n', 26, '\n'};
+    unsigned char header[13] = {0}, *raw, *packed, *row;
+    const unsigned char *above;
+    uLongf size = compressBound(SCREEN_SIZE_Y * (PITCH + 1));
+    FILE *fp;
+    int y, x, ok;
+
+    raw = malloc(SCREEN_SIZE_Y * (PITCH + 1));
+    packed = malloc(size);
+    if (!raw || !packed)
+        exit(fprintf(stderr, "Out of memory\n"));
+
+    raw[0] = 0;             // None for the first row, Up for the rest
+    memcpy(raw + 1, pixels, PITCH);
+    for (y = 1; y < SCREEN_SIZE_Y; y++)
+    {
+        row = raw + y * (PITCH + 1);
+        above = pixels + (y - 1) * PITCH;
+        row[0] = 2;
+        if (!memcmp(above + PITCH, above, PITCH))
+            memset(row + 1, 0, PITCH); // Scaled tiles repeat rows
+        else
+            for (x = 0; x < PITCH; x++)
+                row[x + 1] = above[PITCH + x] - above[x];
+    }
+    ok = compress2(packed, &size, raw, SCREEN_SIZE_Y * (PITCH + 1),
+        ZlibLevel) == Z_OK;
+
+    Put32(header, SCREEN_SIZE_X);
+    Put32(header + 4, SCREEN_SIZE_Y);
+    header[8] = 8;        // Bits per channel
+    header[9] = 6;        // RGBA
+    if (ok && (fp = fopen(path, "wb")) != NULL)
+    {
+        ok = fwrite(signature, 8, 1, fp) == 1
+            && Chunk(fp, "IHDR", header, 13) == 0
+            && Chunk(fp, "IDAT", packed, size) == 0
+            && Chunk(fp, "IEND", NULL, 0) == 0;
+        ok = fclose(fp) == 0 && ok;
+    } else
+        ok = 0;
+
+    free(raw);
+    free(packed);
+    return ok ? 0 : -1;
+}
+
+static void Encode(struct task *task, struct worker *worker)
+{
+    struct png *png = task->arg;
+
+    (void)worker;
+    png->result = WritePng(png->path, png->pixels);
+}
+
+
+// The screen at the start of the level, into <prefix><level>.png
+static void Thumbnail(struct task *task, struct worker *worker)
+{
+    struct png *png = task->arg;
+    struct world world;
+    struct canvas canvas;
+    const char *base = strrchr(png->name, '/');
+
+    (void)worker;
+    base = base ? base + 1 : png->name;
+    snprintf(png->path, sizeof(png->path), "%s%.*s.png", Prefix,
+        LevelIsFile(base) ? (int)(strlen(base) - 4) : (int)strlen(base), base);
+
+    png->result = -1;
+    if (WorldStartNamed(&world, png->name, 1) == 0)
+    {
+        CanvasInit(&canvas);
+        Draw(&canvas, &world, 0);
+        png->result = WritePng(png->path, canvas.pixels);
+        CanvasFree(&canvas);
+    }
+    WorldFree(&world);
+}
+
+int Thumbnails(char **names, int count, int threads)
+{
+    struct png *pngs = calloc(count, sizeof(struct png));
+    struct task **list = calloc(count, sizeof(struct task *));
+    double start = Seconds(), elapsed;
+    int i, failed = 0;
+
+    if (!pngs || !list)
+        exit(fprintf(stderr, "Out of memory\n"));
+    for (i = 0; i < count; i++)
+    {
+        pngs[i].task.run = Thumbnail;
+        pngs[i].task.arg = &pngs[i];
+        pngs[i].name = names[i];
+        list[i] = &pngs[i].task;
+    }
+    PoolRun(list, count, threads, NULL);
+    elapsed = Seconds() - start;
+
+    for (i = 0; i < count; i++)
+        if (pngs[i].result < 0)
+        {
+            fprintf(stderr, "Could not render level %s into %s\n",
+                pngs[i].name, pngs[i].path);
+            failed++;
+        }
+    fprintf(stderr, "thumbnails %d failed %d threads %d seconds %.3f "
+        "frames/s %.0f\n", count, failed, threads, elapsed,
+        count / elapsed);
+
+    free(pngs);
+    free(list);
+    return failed ? 1 : 0;
+}
+
+
+/***************************************************************
+ * Every tick of a replay, as the game shows it: one frame per *
+ * tick, the second long pauses of a finished level included.  *
+ * Raw RGBA to a file or stdout, or PNG files compressed on    *
+ * all cores a few dozen at a time.                            *
+ ***************************************************************/
+struct video
+{
+    FILE *fp;               // Raw stream, NULL for PNG files
+    struct png png[ENCODE_FRAMES];
+    struct task *list[ENCODE_FRAMES];
+    int count, threads, failed;
+    long frames;
+};
+
+static void Flush(struct video *video)
+{
+    int k;
+
+    PoolRun(video->list, video->count, video->threads, NULL);
+    for (k = 0; k < video->count; k++)
+        video->failed |= video->png[k].result < 0;
+    video->count = 0;
+}
+
+static void Emit(struct video *video, struct canvas *canvas)
+{
+    struct png *png = &video->png[video->count];
+
+    if (video->fp)
+        video->failed |= fwrite(canvas->pixels, FRAME_BYTES, 1, video->fp)
+            != 1;
+    else
+    {
+        snprintf(png->path, sizeof(png->path), "%s%06ld.png", Prefix,
+            video->frames);
+        memcpy(png->pixels, canvas->pixels, FRAME_BYTES);
+        video->list[video->count] = &png->task;
+        if (++video->count == ENCODE_FRAMES)
+            Flush(video);
+    }
+    video->frames++;
+}
+
+int Video(const char *path, const char *out, int threads)
+{
+    static struct video video;
+    struct replay replay = {0};
+    struct world world;
+    struct canvas canvas;
+    double start;
+    int events, status = 0, k, result;
+
+    if (ReplayLoad(&replay, path) < 0)
+        exit(fprintf(stderr, "Could not read %s\n", path));
+    video.threads = threads;
+    if (out)
+        video.fp = strcmp(out, "-") ? fopen(out, "wb") : stdout;
+    if (out && !video.fp)
+        exit(fprintf(stderr, "Could not write %s\n", out));
+    for (k = 0; !out && k < ENCODE_FRAMES; k++)
+    {
+        video.png[k].task.run = Encode;
+        video.png[k].task.arg = &video.png[k];
+        if (!(video.png[k].pixels = malloc(FRAME_BYTES)))
+            exit(fprintf(stderr, "Out of memory\n"));
+    }
+
+    start = Seconds();
+    CanvasInit(&canvas);
+    ReplayRewind(&replay);
+    WorldStart(&world, replay.level, replay.seed);
+    Draw(&canvas, &world, status);
+    Emit(&video, &canvas);
+    while (world.tick < replay.end)
+    {
+        events = WorldStep(&world, ReplayInput(&replay, world.tick));
+        if (events & WORLD_PHYSICS)
+            status = events;
+
+        if (events & WORLD_LEVEL_DONE)
+        {
+            for (k = 0; k < TICK_RATE; k++)
+                Emit(&video, &canvas);
+            Draw(&canvas, &world, events);
+            for (k = 0; k < TICK_RATE; k++)
+                Emit(&video, &canvas);
+            status = 0;
+        }
+        Draw(&canvas, &world, status);
+        Emit(&video, &canvas);
+    }
+    if (video.count)
+        Flush(&video);
+    if (video.fp && video.fp != stdout)
+        video.failed |= fclose(video.fp) != 0;
+
+    result = WorldChecksum(&world) == replay.checksum;
+    fprintf(stderr, "replay %s frames %ld %dx%d seconds %.3f frames/s %.0f"
+        "%s\n", result ? "identical" : "DIFFERENT", video.frames,
+        SCREEN_SIZE_X, SCREEN_SIZE_Y, Seconds() - start,
+        video.frames / (Seconds() - start),
+        video.failed ? " write_failed" : "");
+
+    for (k = 0; !out && k < ENCODE_FRAMES; k++)
+        free(video.png[k].pixels);
+    CanvasFree(&canvas);
+    WorldFree(&world);
+    ReplayFree(&replay);
+    return result && !video.failed ? 0 : 1;
+}
+
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: render [-j threads] [-o prefix] [-z zlib_level] [-L pack]\n"
+        "              [level|file.lvl ...]   (every level when none)\n"
+        "       render -p replay [-o file.rgba | -]  (raw RGBA, %dx%d)\n"
+        "       render -p replay [-j threads] [-o prefix] [-z zlib_level]\n",
+        SCREEN_SIZE_X, SCREEN_SIZE_Y);
+    exit(1);
+}
+
+
+/********
+ * Main *
+ ********/
+int main(int argc, char **argv)
+{
+    const char *pack = NULL, *play = NULL, *out = NULL, *bitmap;
+    char **names, *number;
+    struct world world;
+    int threads = 0, opt, count, i;
+
+    while ((opt = getopt(argc, argv, "j:o:z:L:p:")) != -1)
+        switch (opt)
+        {
+            case 'j': threads = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            case 'z': ZlibLevel = atoi(optarg); break;
+            case 'L': pack = optarg; break;
+            case 'p': play = optarg; break;
+            default: Usage();
+        }
+    if (ZlibLevel < 0 || ZlibLevel > 9)
+        Usage();
+    if (threads < 1)
+        threads = PoolThreads();
+
+    // The tile rules, the built in ones when there is no file
+    if ((i = RulesLoad(RULES_FILE)) > 0)
+        exit(fprintf(stderr, "Bad rule in %s line %d\n", RULES_FILE, i));
+
+    if ((pack ? PackOpen(&Pack, pack) : PackOpenDefault(&Pack)) == 0)
+        LevelPack = &Pack;
+    else
+    if (pack)
+        exit(fprintf(stderr, "Could not read %s\n", pack));
+
+    if ((bitmap = CanvasLoad()) != NULL)
+        exit(fprintf(stderr, "Could not load %s\n", bitmap));
+
+    // A replay: raw RGBA when a file ending in .rgba or - is given
+    if (play)
+    {
+        if (out && (!strcmp(out, "-") || (strlen(out) > 5
+            && !strcmp(out + strlen(out) - 5, ".rgba"))))
+            return Video(play, out, threads);
+        Prefix = out ? out : "frame-";
+        return Video(play, NULL, threads);
+    }
+
+    if (out)
+        Prefix = out;
+    count = argc - optind;
+    names = argv + optind;
+    if (!count)
+    {
+        // Every level there is, by number
+        WorldInit(&world);
+        while (LevelPack ? count < LevelPack->count
+               : LoadLevel(&world, count) == 0)
+            count++;
+        WorldFree(&world);
+        if (!count || !(names = malloc(count * sizeof(char *))))
+            exit(fprintf(stderr, "No levels in res/\n"));
+        for (i = 0; i < count; i++)
+        {
+            if (!(number = malloc(12)))
+                exit(fprintf(stderr, "Out of memory\n"));
+            snprintf(number, 12, "%d", i + 1);
+            names[i] = number;
+        }
+    }
+
+    return Thumbnails(names, count, threads);
+}
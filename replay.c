@@ -0,0 +1,249 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "replay.h"
+
+#define REPLAY_VERSION      2
+#define REPLAY_HEADER       16
+
+
+/****************************
+ * Little endian and varint *
+ ****************************/
+static void Put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t Get32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void PutByte(struct replay *replay, unsigned char b)
+{
+    if (replay->size == replay->alloc)
+    {
+        replay->alloc = replay->alloc ? replay->alloc * 2 : 256;
+        replay->data = realloc(replay->data, replay->alloc);
+        if (!replay->data)
+            exit(fprintf(stderr, "Out of memory\n"));
+    }
+    replay->data[replay->size++] = b;
+}
+
+static void PutVarint(struct replay *replay, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        PutByte(replay, (v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    PutByte(replay, v);
+}
+
+static int GetVarint(struct replay *replay, uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (replay->pos < replay->size && shift < 64)
+    {
+        unsigned char b = replay->data[replay->pos++];
+
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return 0;
+        shift += 7;
+    }
+    return -1;
+}
+
+
+/*************
+ * Recording *
+ *************/
+void ReplayStart(struct replay *replay, int level, uint32_t seed)
+{
+    memset(replay, 0, sizeof(*replay));
+    replay->level = level;
+    replay->seed = seed;
+}
+
+void ReplayRecord(struct replay *replay, long tick, enum input input)
+{
+    PutVarint(replay, (uint64_t)(tick - replay->last) << 4 | input);
+    replay->last = tick;
+}
+
+// Forget the records from tick on, when the game went back in time
+void ReplayTruncate(struct replay *replay, long tick)
+{
+    size_t keep = 0;
+    long last = 0;
+    uint64_t v;
+
+    replay->pos = 0;
+    while (replay->pos < replay->size && GetVarint(replay, &v) == 0
+        && last + (long)(v >> 4) < tick)
+    {
+        last += v >> 4;
+        keep = replay->pos;
+    }
+    replay->size = keep;
+    replay->last = last;
+    replay->pos = 0;
+}
+
+void ReplayEnd(struct replay *replay, struct world *world)
+{
+    replay->end = world->tick;
+    replay->checksum = WorldChecksum(world);
+}
+
+
+/**************************
+ * Log file save and load *
+ **************************/
+int ReplaySave(struct replay *replay, const char *path)
+{
+    unsigned char header[REPLAY_HEADER] = {'B', 'P', 'R', 'L', REPLAY_VERSION};
+    unsigned char sum[4];
+    size_t size = replay->size;
+    FILE *fp;
+    int ok;
+
+    fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+
+    Put32(header + 8, replay->seed);
+    Put32(header + 12, replay->level);
+    Put32(sum, replay->checksum);
+    PutVarint(replay, (uint64_t)(replay->end - replay->last) << 4);
+
+    ok = fwrite(header, sizeof(header), 1, fp) == 1
+        && fwrite(replay->data, 1, replay->size, fp) == replay->size
+        && fwrite(sum, sizeof(sum), 1, fp) == 1;
+    replay->size = size; // Recording may go on
+    return (fclose(fp) == 0 && ok) ? 0 : -1;
+}
+
+int ReplayLoad(struct replay *replay, const char *path)
+{
+    unsigned char header[REPLAY_HEADER];
+    FILE *fp;
+    long size;
+    uint64_t v;
+
+    memset(replay, 0, sizeof(*replay));
+    fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+
+    if (fread(header, sizeof(header), 1, fp) != 1
+        || memcmp(header, "BPRL", 4) || header[4] != REPLAY_VERSION)
+    {
+        fclose(fp);
+        return -1;
+    }
+    replay->seed = Get32(header + 8);
+    replay->level = Get32(header + 12);
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp) - REPLAY_HEADER - 4;
+    fseek(fp, REPLAY_HEADER, SEEK_SET);
+    if (size < 1 || !(replay->data = malloc(size + 4))
+        || fread(replay->data, 1, size + 4, fp) != (size_t)size + 4)
+    {
+        fclose(fp);
+        ReplayFree(replay);
+        return -1;
+    }
+    fclose(fp);
+
+    replay->size = replay->alloc = size;
+    replay->checksum = Get32(replay->data + size);
+
+    // The session length is the sum of all deltas
+    while (replay->pos < replay->size)
+    {
+        if (GetVarint(replay, &v) < 0)
+        {
+            ReplayFree(replay);
+            return -1;
+        }
+        replay->end += v >> 4;
+    }
+
+    ReplayRewind(replay);
+    return 0;
+}
+
+
+/************
+ * Playback *
+ ************/
+static void ReplayDecode(struct replay *replay)
+{
+    uint64_t v;
+
+    if (GetVarint(replay, &v) < 0)
+    {
+        replay->next = LONG_MAX;
+        replay->input = INPUT_NONE;
+        return;
+    }
+    replay->last += v >> 4;
+    replay->next = replay->last;
+    replay->input = v & 15;
+}
+
+void ReplayRewind(struct replay *replay)
+{
+    replay->pos = 0;
+    replay->last = 0;
+    ReplayDecode(replay);
+}
+
+enum input ReplayInput(struct replay *replay, long tick)
+{
+    enum input input;
+
+    if (tick != replay->next)
+        return INPUT_NONE;
+
+    input = replay->input;
+    ReplayDecode(replay);
+    return input;
+}
+
+
+/*******************************************************
+ * Replay the whole session headless, check the result *
+ * (world as WorldStart takes it, WorldFree it after)  *
+ *******************************************************/
+int ReplayRun(struct replay *replay, struct world *world)
+{
+    ReplayRewind(replay);
+    WorldStart(world, replay->level, replay->seed);
+
+    while (world->tick < replay->end)
+        WorldStep(world, ReplayInput(replay, world->tick));
+
+    return WorldChecksum(world) == replay->checksum ? 0 : -1;
+}
+
+
+void ReplayFree(struct replay *replay)
+{
+    free(replay->data);
+    replay->data = NULL;
+    replay->size = replay->alloc = 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>
+#include "world.h"
+
+/*
+ * Input log of one session. On disk (little endian):
+ *   "BPRL", u8 version, 3 x u8 zero, u32 seed, u32 level
+ *   records: varint (ticks since the previous record << 4 | input)
+ *   end:     varint (ticks to the end of the session << 4 | INPUT_NONE),
+ *            u32 WorldChecksum of the final state
+ */
+struct replay
+{
+    unsigned char *data;  // Records, the end record included after loading
+    size_t size, alloc;
+    size_t pos;           // Playback position in data
+    uint32_t seed;
+    int level;
+    long last;            // Tick of the last record written or read
+    long next;            // Playback: tick of the pending record
+    enum input input;     // Playback: input of the pending record
+    long end;             // Ticks in the whole session
+    uint32_t checksum;    // World state at the end
+};
+
+void ReplayStart(struct replay *replay, int level, uint32_t seed);
+void ReplayRecord(struct replay *replay, long tick, enum input input);
+void ReplayTruncate(struct replay *replay, long tick);
+void ReplayEnd(struct replay *replay, struct world *world);
+int ReplaySave(struct replay *replay, const char *path);
+int ReplayLoad(struct replay *replay, const char *path);
+void ReplayRewind(struct replay *replay);
+enum input ReplayInput(struct replay *replay, long tick);
+int ReplayRun(struct replay *replay, struct world *world);
+void ReplayFree(struct replay *replay);
+
+#endif
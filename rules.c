@@ -0,0 +1,108 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rules.h"
+
+#ifndef RULES_FIXED
+
+#define MASKS               7
+
+struct rules Rules = RULES_DEFAULT;
+
+
+/****************************************************************
+ * One line of a rules file: the tile's number, a name, and the *
+ * rules it has; -1 when something in it is not a rule          *
+ ****************************************************************/
+static int RuleLine(struct rules *rules, char *line)
+{
+    static const char *names[MASKS] = {"solid", "blocks", "falls",
+        "pushable", "collect", "immune", "explosive"};
+    uint16_t *masks[MASKS];
+    char *word, *end;
+    int tile, k, v;
+
+    masks[0] = &rules->solid;
+    masks[1] = &rules->blocks;
+    masks[2] = &rules->falls;
+    masks[3] = &rules->pushable;
+    masks[4] = &rules->collect;
+    masks[5] = &rules->immune;
+    masks[6] = &rules->explosive;
+
+    if (!(word = strtok(line, " \t\r\n")) || word[0] == '#')
+        return 0;
+    tile = strtol(word, &end, 10);
+    if (*end || tile < 0 || tile > 15 || !strtok(NULL, " \t\r\n"))
+        return -1;
+
+    // The line gives everything about the tile
+    for (k = 0; k < MASKS; k++)
+        *masks[k] &= ~TILE_BIT(tile);
+    rules->crash[tile] = CRASH;
+    rules->texture[tile] = 0;
+
+    while ((word = strtok(NULL, " \t\r\n")) && word[0] != '#')
+    {
+        for (k = 0; k < MASKS && strcmp(word, names[k]); k++)
+            ;
+        if (k < MASKS)
+            *masks[k] |= TILE_BIT(tile);
+        else
+        if (!strncmp(word, "crash=", 6))
+        {
+            v = strtol(word + 6, &end, 10);
+            if (*end || v < 0 || v > 15)
+                return -1;
+            rules->crash[tile] = v;
+        } else
+        if (!strncmp(word, "texture=", 8))
+        {
+            v = strtol(word + 8, &end, 10);
+            if (*end || v < 0 || v > 255)
+                return -1;
+            rules->texture[tile] = v;
+        } else
+            return -1;
+    }
+    return 0;
+}
+
+
+/*********************************************************************
+ * Read a rules file, "3 rock solid blocks falls pushable texture=6" *
+ * and so on; the tiles not in it keep their rules. 0 when read, -1  *
+ * when it cannot be opened, or the number of the first bad line     *
+ * (nothing changed then)                                            *
+ *********************************************************************/
+int RulesLoad(const char *path)
+{
+    struct rules rules = Rules;
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int n = 0;
+
+    if (fp == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        n++;
+        if (RuleLine(&rules, line) < 0)
+        {
+            fclose(fp);
+            return n;
+        }
+    }
+
+    fclose(fp);
+    Rules = rules;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+#include "world.h"
+
+#define RULES_FILE          "res/rules.txt"
+
+/*
+ * What each tile does, one bit per tile in each mask, so a rule is a
+ * shift and a mask in the physics, and a whole row of the bitboard
+ * engine at once. Tiles 11 to 15 have no rule until a rules file gives
+ * them one (written ; < = > ? in a .lvl file).
+ */
+struct rules
+{
+    uint16_t solid;       // Rocks and diamonds roll off it
+    uint16_t blocks;      // The hero cannot walk into it
+    uint16_t falls;       // Falls, rolls and crushes as a rock does
+    uint16_t pushable;    // The hero pushes it sideways
+    uint16_t collect;     // Picked up by the hero, as a diamond
+    uint16_t immune;      // An explosion leaves it
+    uint16_t explosive;   // Blows up under a rock or when the hero touches it
+    unsigned char crash[16];   // Tile its explosion leaves around it
+    unsigned char texture[16]; // Bitmap the frontend draws for it
+};
+
+#define TILE_BIT(t)         (1u << (t))
+
+// The rules of the original game, also in RULES_FILE
+#define RULES_DEFAULT { \
+    TILE_BIT(WALL) | TILE_BIT(ROCK) | TILE_BIT(DIAMOND) | TILE_BIT(METAL) \
+        | TILE_BIT(DOOR), \
+    TILE_BIT(WALL) | TILE_BIT(ROCK) | TILE_BIT(METAL), \
+    TILE_BIT(ROCK) | TILE_BIT(DIAMOND), \
+    TILE_BIT(ROCK), \
+    TILE_BIT(DIAMOND), \
+    TILE_BIT(METAL), \
+    TILE_BIT(BOX) | TILE_BIT(FLY), \
+    {CRASH, CRASH, CRASH, CRASH, CRASH, CRASH, CRASH, CRASH, CRASH, \
+     DIAMOND, CRASH, CRASH, CRASH, CRASH, CRASH, CRASH}, \
+    {0, 1, 4, 6, 7, 8, 9, 11, 10, 13, 12, 0, 0, 0, 0, 0}}
+
+/*
+ * Built with -DRULES_FIXED the table is a constant: every rule folds
+ * into the code as the comparisons it replaces, and no file is read.
+ */
+#ifdef RULES_FIXED
+static const struct rules Rules __attribute__((unused)) = RULES_DEFAULT;
+#define RulesLoad(path)     (-1)
+#else
+// Rules of all the worlds, changed only before the first one starts
+extern struct rules Rules;
+
+int RulesLoad(const char *path);
+#endif
+
+// Has the tile this rule (solid, blocks, ...)
+#define RULE(rule, tile)    (Rules.rule >> (tile) & 1)
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include "rules.h"
+#include "screen.h"
+
+const char BitmapFile[BITMAP_MAX][32] = {"res/tunnel.bmp", "res/wall.bmp",
+    "res/heror.bmp", "res/herol.bmp", "res/hero1.bmp", "res/hero2.bmp",
+    "res/rock.bmp", "res/diamond.bmp", "res/ground.bmp", "res/metal.bmp",
+    "res/door.bmp", "res/box.bmp", "res/crash.bmp", "res/fly.bmp"};
+
+
+/*******************************
+ * Select the appropriate tile *
+ *******************************/
+int SelectTile(int item, enum hero hero)
+{
+    int t;
+
+    // The hero as it moves, the others as the rules say
+    if (item == HERO)
+        switch (hero)
+        {
+            case RIGHT: t = 2; break;
+            case LEFT:  t = 3; break;
+            case FACE2: t = 5; break;
+            default:    t = Rules.texture[HERO];
+        }
+    else
+        t = Rules.texture[item & 15];
+
+    return t < BITMAP_MAX ? t : 0;
+}
+
+
+/**********************************************************
+ * The view follows the player (or the place of the       *
+ * crash); smaller levels than the screen are shown whole *
+ **********************************************************/
+void ViewPlace(const struct world *world, struct view *view)
+{
+    view->width = world->width < BOARD_WIDTH ? world->width : BOARD_WIDTH;
+    view->high = world->height < BOARD_HIGH ? world->height : BOARD_HIGH;
+
+    view->startx = world->game.lastposx - view->width / 2;
+    if (view->startx > world->width - view->width)
+        view->startx = world->width - view->width;
+    if (view->startx < 0)
+        view->startx = 0;
+
+    view->starty = world->game.lastposy - view->high / 2;
+    if (view->starty > world->height - view->high)
+        view->starty = world->height - view->high;
+    if (view->starty < 0)
+        view->starty = 0;
+}
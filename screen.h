@@ -0,0 +1,49 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "world.h"
+
+/*
+ * The game screen as both the window (boulder.c) and the CPU renderer
+ * (canvas.c) draw it: its size, the tile bitmaps, which one a cell shows
+ * and the part of the board in view. Kept here once so that thumbnails
+ * and videos look like the game.
+ */
+#define TILE_SIZE           30
+#define BITMAP_MAX          14
+
+#define SCREEN_SIZE_X       640
+#define SCREEN_SIZE_Y       480
+
+#define X_MARGIN            5
+#define Y_MARGIN            5
+
+#define BOARD_WIDTH         (SCREEN_SIZE_X / TILE_SIZE)
+#define BOARD_HIGH          ((SCREEN_SIZE_Y / TILE_SIZE) - 1) // Bottom margin
+
+// Status line: its top, the baseline of the texts and where each starts
+#define STATUS_Y            (SCREEN_SIZE_Y - TILE_SIZE + Y_MARGIN)
+#define TEXT_Y              ((int)(SCREEN_SIZE_Y - TILE_SIZE / 1.5))
+#define LEVEL_X             (TILE_SIZE + X_MARGIN)
+#define DIAMONDS_X          ((int)(TILE_SIZE + SCREEN_SIZE_X / 3))
+#define TIME_X              ((int)(TILE_SIZE + SCREEN_SIZE_X / 1.5))
+#define MUTE_X              (SCREEN_SIZE_X - TILE_SIZE)
+#define END_X               ((int)(SCREEN_SIZE_X / 3)) // Game over, done
+
+// Part of the board on the screen, in cells
+struct view
+{
+    int startx, starty, width, high;
+};
+
+extern const char BitmapFile[BITMAP_MAX][32];
+
+int SelectTile(int item, enum hero hero);
+void ViewPlace(const struct world *world, struct view *view);
+
+#endif
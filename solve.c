@@ -0,0 +1,690 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ *
+ * Level solver: searches the hero's moves for a way through a level,
+ * played by the real rules, on all cores.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "world.h"
+#include "pool.h"
+#include "pack.h"
+#include "rules.h"
+#include "replay.h"
+#include "tools.h"
+
+#define BUDGET_MB           256   // Nodes and transposition table
+#define TABLE_SHARE         8     // Part of the budget for the table
+#define PROBES              16    // Table slots tried for one state
+#define WEIGHT              4     // Of the estimate against the steps made
+#define DIAMOND_COST        256   // More than any way to the next one
+#define STEP_TICKS          4     // Ticks from one move to the next
+#define PACK_GAP            3     // Equal bytes copied rather than skipped
+#define STATE_ALIGN         4     // Packed states start on these
+#define STATE_MIN           64    // Bytes a packed state takes at least
+
+// One move of the hero, then StepTicks ticks in all
+enum step {WAIT, GO_LEFT, GO_RIGHT, GO_UP, GO_DOWN,
+           DIG_LEFT, DIG_RIGHT, DIG_UP, DIG_DOWN, STEPS};
+
+// Searched out: no way at all, or none with a move every StepTicks only
+enum result {UNSOLVABLE, SOLVED, OUT_OF_BUDGET, NOT_FOUND};
+
+struct node
+{
+    int parent;           // -1 at the start
+    int depth;            // Steps from the start
+    enum step step;       // Step from the parent
+    unsigned state;       // At Arena + state * STATE_ALIGN, see PackState
+};
+
+// Entry of the open list, lowest f first, then the one nearer the goal
+struct open
+{
+    int f;
+    int h;
+    int node;
+};
+
+/********************
+ * Global variables *
+ ********************/
+const char StepKey[STEPS + 1] = ".adwsADWS"; // Path as printed
+long BudgetMb = BUDGET_MB;
+int Weight = WEIGHT;
+int StepTicks = STEP_TICKS;
+uint32_t Seed;
+struct pack Pack;
+
+// Search of one level
+struct world Start;       // The level as loaded
+size_t StateBytes;
+unsigned char *Base;      // StateBytes of the start, the others packed
+unsigned char *Arena;     // against it; reserved whole, used as it goes
+size_t ArenaSize;         // Budget of the nodes, their packed states too
+atomic_size_t ArenaUsed;
+struct node *Nodes;
+atomic_int NodeCount;
+int NodesMax;
+_Atomic uint64_t *TableKey; // Transposition table, 0 is a free slot
+atomic_int *TableTime;    // Most time left the state was reached with
+size_t TableMask;
+struct open *Heap;
+int HeapCount;
+pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Changed = PTHREAD_COND_INITIALIZER;
+int Busy;
+atomic_int Done;
+enum result Result;
+int GoalParent;
+enum step GoalStep;
+atomic_long Expanded;
+
+
+/*******************************************
+ * The open list, a binary heap under Lock *
+ *******************************************/
+int Before(const struct open *a, const struct open *b)
+{
+    return a->f < b->f || (a->f == b->f && a->h < b->h);
+}
+
+void Push(int f, int h, int node)
+{
+    struct open add = {f, h, node};
+    int i = HeapCount++, up;
+
+    while (i > 0 && Before(&add, &Heap[up = (i - 1) / 2]))
+    {
+        Heap[i] = Heap[up];
+        i = up;
+    }
+    Heap[i] = add;
+}
+
+int Pop(void)
+{
+    struct open last = Heap[--HeapCount];
+    int node = Heap[0].node, i = 0, child;
+
+    while ((child = 2 * i + 1) < HeapCount)
+    {
+        if (child + 1 < HeapCount && Before(&Heap[child + 1], &Heap[child]))
+            child++;
+        if (!Before(&Heap[child], &last))
+            break;
+        Heap[i] = Heap[child];
+        i = child;
+    }
+    Heap[i] = last;
+    return node;
+}
+
+
+/*****************************************************************
+ * A state packed against the start: runs of bytes equal to it   *
+ * skipped, the others copied, each run a varint long. Most of a *
+ * board stays as it was, so a node takes a few hundred bytes,   *
+ * not one for every cell.                                       *
+ *****************************************************************/
+unsigned char *PutCount(unsigned char *p, size_t n)
+{
+    for (; n >= 128; n >>= 7)
+        *p++ = n | 128;
+    *p++ = n;
+    return p;
+}
+
+const unsigned char *GetCount(const unsigned char *p, size_t *n)
+{
+    int shift = 0;
+
+    *n = 0;
+    do
+    {
+        *n |= (size_t)(*p & 127) << shift;
+        shift += 7;
+    } while (*p++ & 128);
+    return p;
+}
+
+// At most 2 * StateBytes + 16 bytes go to out
+size_t PackState(const unsigned char *state, unsigned char *out)
+{
+    unsigned char *p = out;
+    size_t i = 0, start, end;
+
+    while (i < StateBytes)
+    {
+        for (start = i; i < StateBytes && state[i] == Base[i]; i++)
+            ;
+        p = PutCount(p, i - start);
+
+        // A run goes on over a gap of up to PACK_GAP equal bytes
+        for (start = end = i; i < StateBytes && i - end <= PACK_GAP; i++)
+            if (state[i] != Base[i])
+                end = i + 1;
+        i = end;
+        p = PutCount(p, end - start);
+        memcpy(p, state + start, end - start);
+        p += end - start;
+    }
+    return p - out;
+}
+
+void UnpackState(const unsigned char *in, unsigned char *state)
+{
+    size_t i = 0, n;
+
+    memcpy(state, Base, StateBytes);
+    while (i < StateBytes)
+    {
+        in = GetCount(in, &n);
+        i += n;
+        in = GetCount(in, &n);
+        memcpy(state + i, in, n);
+        in += n;
+        i += n;
+    }
+}
+
+// Room for a packed state with nodes in all, -1 once the budget is spent
+long Store(size_t size, int nodes)
+{
+    size_t at = atomic_fetch_add(&ArenaUsed,
+        (size + STATE_ALIGN - 1) / STATE_ALIGN * STATE_ALIGN);
+
+    if (at + size + nodes * (sizeof(struct node) + sizeof(struct open))
+        > ArenaSize)
+        return -1;
+    return at / STATE_ALIGN;
+}
+
+
+/***************************************************************
+ * Lock-free transposition table: 1 if the state is new, or is *
+ * reached now with more time left than ever before            *
+ ***************************************************************/
+int Visit(uint64_t key, int time)
+{
+    size_t i = key & TableMask;
+    uint64_t k;
+    int n, t;
+
+    for (n = 0; n < PROBES; n++, i = (i + 1) & TableMask)
+    {
+        k = atomic_load(&TableKey[i]);
+        if (!k)
+        {
+            if (atomic_compare_exchange_strong(&TableKey[i], &k, key))
+            {
+                atomic_store(&TableTime[i], time);
+                return 1;
+            }
+        }
+        if (k != key)
+            continue;
+
+        t = atomic_load(&TableTime[i]);
+        while (t < time)
+            if (atomic_compare_exchange_weak(&TableTime[i], &t, time))
+                return 1;
+        return 0;
+    }
+
+    return 1; // No room around, search it again rather than lose it
+}
+
+// The board, the diamonds still to take, the time to the next physics
+// update and the random numbers (rocks roll by them) tell states apart;
+// the rest of the state, where the hero looks, changes nothing to come
+uint64_t Key(struct world *world)
+{
+    return (BoardHash(world)
+        ^ (uint64_t)world->game.diamonds * 0x9e3779b97f4a7c15ull
+        ^ (uint64_t)world->refresh_time * 0xc2b2ae3d27d4eb4full
+        ^ ((uint64_t)world->rng[0] << 32 | world->rng[1])
+            * 0x165667b19e3779f9ull
+        ^ ((uint64_t)world->rng[2] << 32 | world->rng[3])
+            * 0xd6e8feb86659fd93ull) | 1;
+}
+
+int TimeLeft(struct world *world)
+{
+    return world->game.time * (INTER_TIME + 1) + world->decrement_time;
+}
+
+
+/***************************************************************
+ * Steps still needed at least, roughly: the diamonds to take  *
+ * and the way (through the cells the hero can enter) to the   *
+ * nearest one, or to the door; -1 if dead or out of time.    *
+ * What the hero can enter and take comes from the rules table *
+ ***************************************************************/
+int Passable(int b)
+{
+    return !RULE(blocks, b) && !RULE(explosive, b);
+}
+
+// The cell, METAL beyond the board as MoveHero has it
+int Cell(struct world *world, int j, int i)
+{
+    if (j < 0 || i < 0 || j >= world->height || i >= world->width)
+        return METAL;
+    return GetBoard(world, j, i);
+}
+
+int Estimate(struct world *world, int *queue, unsigned char *seen)
+{
+    int hy, hx, head = 0, tail = 0, pos, j, i, d, b;
+    static const int dj[] = {-1, 0, 1, 0}, di[] = {0, 1, 0, -1};
+
+    if (world->game.hero_state == KILLED || world->game.time <= 0
+        || FindObject(world, HERO, &hy, &hx) != HERO)
+        return -1;
+
+    // Breadth first from the hero, the distance kept in the queue order
+    memset(seen, 0, world->width * world->height);
+    queue[tail++] = hy * world->width + hx;
+    seen[queue[0]] = 1;
+    while (head < tail)
+    {
+        pos = queue[head++];
+        for (d = 0; d < 4; d++)
+        {
+            j = pos / world->width + dj[d];
+            i = pos % world->width + di[d];
+            if (j < 0 || i < 0 || j >= world->height || i >= world->width
+                || seen[j * world->width + i]
+                || !Passable(b = GetBoard(world, j, i)))
+                continue;
+            seen[j * world->width + i] = seen[pos] + 1 > 255
+                ? 255 : seen[pos] + 1;
+            if (world->game.diamonds ? RULE(collect, b) : b == DOOR)
+                return world->game.diamonds * DIAMOND_COST
+                    + seen[j * world->width + i] - 1;
+            queue[tail++] = j * world->width + i;
+        }
+    }
+
+    // Nothing in reach now, rocks may still open a way
+    return world->game.diamonds * DIAMOND_COST + 255;
+}
+
+
+/*****************************************************************
+ * Steps that would only wait (into a wall, digging a tunnel, a  *
+ * push with no room) or blow the hero up are not worth playing; *
+ * the cell is taken as MoveHero takes it, by the rules table    *
+ *****************************************************************/
+int Useful(struct world *world, enum step step)
+{
+    static const int dj[] = {0, 0, 0, -1, 1}, di[] = {0, -1, 1, 0, 0};
+    int j, i, o, move = step >= DIG_LEFT ? step - (DIG_LEFT - GO_LEFT) : step;
+
+    if (step == WAIT || FindObject(world, HERO, &j, &i) != HERO)
+        return 1;
+
+    o = Cell(world, j + dj[move], i + di[move]);
+    if (RULE(collect, o))
+        return 1;
+    if (RULE(explosive, o))
+        return RULE(immune, HERO);
+    if (RULE(pushable, o) && di[move]
+        && Cell(world, j, i + 2 * di[move]) == TUNNEL)
+        return 1;
+    return !RULE(blocks, o) && (o != DOOR || !world->game.diamonds)
+        && (step < DIG_LEFT || o != TUNNEL);
+}
+
+
+/***************************************************
+ * Play one step, the events of all its ticks back *
+ ***************************************************/
+int Tick(struct world *world, enum input input, struct replay *replay)
+{
+    if (replay && input != INPUT_NONE)
+        ReplayRecord(replay, world->tick, input);
+    return WorldStep(world, input);
+}
+
+int Play(struct world *world, enum step step, struct replay *replay)
+{
+    static const enum input move[] = {INPUT_NONE, INPUT_LEFT, INPUT_RIGHT,
+                                      INPUT_UP, INPUT_DOWN};
+    int events = 0, ticks = 1;
+
+    // Digging is the move in GHOST mode, the hero stays in place
+    if (step >= DIG_LEFT)
+    {
+        events |= Tick(world, INPUT_ACTION, replay);
+        step -= DIG_LEFT - GO_LEFT;
+        ticks++;
+    }
+    events |= Tick(world, move[step], replay);
+
+    for (; ticks < StepTicks; ticks++)
+    {
+        if (events & (WORLD_GAME_OVER | WORLD_LEVEL_DONE))
+            break;
+        events |= Tick(world, INPUT_NONE, replay);
+    }
+    return events;
+}
+
+
+/*****************************************************************
+ * The search itself, one per thread: take the best open node,   *
+ * try every step from it, keep the children nobody reached yet  *
+ *****************************************************************/
+void Finish(enum result result)
+{
+    if (!Done)
+        Result = result;
+    Done = 1;
+    pthread_cond_broadcast(&Changed);
+}
+
+void Search(struct task *task, struct worker *worker)
+{
+    struct world world;
+    struct node *node;
+    int parent, child, step, events, h, useful[STEPS];
+    long at;
+    size_t size;
+    int *queue = malloc(Start.width * Start.height * sizeof(int));
+    unsigned char *seen = malloc(Start.width * Start.height);
+    unsigned char *from = malloc(StateBytes), *to = malloc(StateBytes);
+    unsigned char *packed = malloc(2 * StateBytes + 16);
+
+    if (!queue || !seen || !from || !to || !packed)
+        exit(fprintf(stderr, "Out of memory\n"));
+    WorldInit(&world);
+    world.physics = PHYSICS_BITBOARD;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&Lock);
+        while (!HeapCount && Busy && !Done)
+            pthread_cond_wait(&Changed, &Lock);
+        if (Done || !HeapCount)
+        {
+            // Nothing left to try, with a move on every tick or not
+            Finish(StepTicks == 1 ? UNSOLVABLE : NOT_FOUND);
+            pthread_mutex_unlock(&Lock);
+            break;
+        }
+        parent = Pop();
+        Busy++;
+        pthread_mutex_unlock(&Lock);
+        atomic_fetch_add(&Expanded, 1);
+
+        UnpackState(Arena + (size_t)Nodes[parent].state * STATE_ALIGN, from);
+        StateLoad(&world, from);
+        for (step = 0; step < STEPS; step++)
+            useful[step] = Useful(&world, step);
+
+        for (step = 0; step < STEPS && !Done; step++)
+        {
+            if (!useful[step])
+                continue;
+            StateLoad(&world, from);
+            events = Play(&world, step, NULL);
+
+            if (events & WORLD_LEVEL_DONE)
+            {
+                pthread_mutex_lock(&Lock);
+                if (!Done)
+                {
+                    GoalParent = parent;
+                    GoalStep = step;
+                }
+                Finish(SOLVED);
+                pthread_mutex_unlock(&Lock);
+                break;
+            }
+            if (events & WORLD_GAME_OVER
+                || (h = Estimate(&world, queue, seen)) < 0
+                || !Visit(Key(&world), TimeLeft(&world)))
+                continue;
+
+            StateSave(&world, to);
+            size = PackState(to, packed);
+            if ((child = atomic_fetch_add(&NodeCount, 1)) >= NodesMax
+                || (at = Store(size, child + 1)) < 0)
+            {
+                pthread_mutex_lock(&Lock);
+                Finish(OUT_OF_BUDGET);
+                pthread_mutex_unlock(&Lock);
+                break;
+            }
+            node = &Nodes[child];
+            node->parent = parent;
+            node->depth = Nodes[parent].depth + 1;
+            node->step = step;
+            node->state = at;
+            memcpy(Arena + (size_t)at * STATE_ALIGN, packed, size);
+
+            pthread_mutex_lock(&Lock);
+            Push(node->depth + Weight * h, h, child);
+            pthread_cond_signal(&Changed);
+            pthread_mutex_unlock(&Lock);
+        }
+
+        pthread_mutex_lock(&Lock);
+        Busy--;
+        pthread_cond_broadcast(&Changed);
+        pthread_mutex_unlock(&Lock);
+    }
+
+    WorldFree(&world);
+    free(packed);
+    free(to);
+    free(from);
+    free(seen);
+    free(queue);
+}
+
+
+/***************************************************
+ * Search one level, the steps of the way to *path *
+ ***************************************************/
+enum result Solve(int threads, char **path, int *steps)
+{
+    size_t budget = (size_t)BudgetMb << 20, slots = 1024;
+    struct task *tasks, **list;
+    int i, n;
+
+    StateBytes = StateSize(&Start);
+    while (slots * 2 * (sizeof(uint64_t) + sizeof(int))
+           <= budget / TABLE_SHARE)
+        slots *= 2;
+
+    // The nodes and their packed states share the rest, counted by Store;
+    // the arrays are only touched as far as the search gets
+    ArenaSize = budget - budget / TABLE_SHARE;
+    if (ArenaSize / STATE_ALIGN > UINT_MAX)
+        ArenaSize = (size_t)UINT_MAX * STATE_ALIGN;
+    NodesMax = ArenaSize
+        / (STATE_MIN + sizeof(struct node) + sizeof(struct open));
+
+    TableMask = slots - 1;
+    TableKey = calloc(slots, sizeof(*TableKey));
+    TableTime = calloc(slots, sizeof(*TableTime));
+    Base = malloc(StateBytes);
+    Arena = malloc(ArenaSize);
+    Nodes = malloc(NodesMax * sizeof(struct node));
+    Heap = malloc(NodesMax * sizeof(struct open));
+    tasks = calloc(threads, sizeof(struct task));
+    list = calloc(threads, sizeof(struct task *));
+    if (!TableKey || !TableTime || !Base || !Arena || !Nodes || !Heap
+        || !tasks || !list || NodesMax < 1)
+        exit(fprintf(stderr, "Out of memory\n"));
+
+    atomic_store(&NodeCount, 1);
+    atomic_store(&ArenaUsed, 0);
+    atomic_store(&Expanded, 0);
+    StateSave(&Start, Base);
+    Nodes[0] = (struct node){-1, 0, WAIT, 0};
+    Store(PackState(Base, Arena), 1);
+    Visit(Key(&Start), TimeLeft(&Start));
+    HeapCount = 0;
+    Busy = Done = 0;
+    Result = StepTicks == 1 ? UNSOLVABLE : NOT_FOUND;
+    if (Start.game.hero_state != KILLED)
+        Push(0, 0, 0);
+
+    for (i = 0; i < threads; i++)
+    {
+        tasks[i].run = Search;
+        list[i] = &tasks[i];
+    }
+    PoolRun(list, threads, threads, NULL);
+
+    *steps = 0;
+    if (Result == SOLVED)
+    {
+        *steps = n = Nodes[GoalParent].depth + 1;
+        if (!(*path = malloc(n + 1)))
+            exit(fprintf(stderr, "Out of memory\n"));
+        (*path)[n] = 0;
+        (*path)[--n] = StepKey[GoalStep];
+        for (i = GoalParent; i > 0; i = Nodes[i].parent)
+            (*path)[--n] = StepKey[Nodes[i].step];
+    }
+
+    free(list);
+    free(tasks);
+    free(Heap);
+    free(Nodes);
+    free(Arena);
+    free(Base);
+    free((void *)TableTime);
+    free((void *)TableKey);
+    return Result;
+}
+
+
+/***************************************************************
+ * Play the way found from the start again, record it if asked *
+ ***************************************************************/
+int Verify(const char *name, const char *path, struct replay *replay)
+{
+    struct world world;
+    int events = 0;
+
+    // A fresh world, on the scalar engine the game runs
+    if (WorldStartNamed(&world, name, Seed) < 0)
+        return -1;
+    for (; *path && !(events & WORLD_LEVEL_DONE); path++)
+        events = Play(&world, strchr(StepKey, *path) - StepKey, replay);
+    if (replay)
+        ReplayEnd(replay, &world);
+    WorldFree(&world);
+    return (events & WORLD_LEVEL_DONE) ? 0 : -1;
+}
+
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: solve [-j threads] [-m megabytes] [-w weight] [-r seed]\n"
+        "             [-s ticks_per_step] [-L pack] [-o replay]\n"
+        "             level|file.lvl ...\n"
+        "       exit status 0 all solved, 1 some unsolvable (searched\n"
+        "       with -s 1), 3 some without a way moving every -s ticks,\n"
+        "       2 undecided\n");
+    exit(4);
+}
+
+
+/********
+ * Main *
+ ********/
+int main(int argc, char **argv)
+{
+    static const char *name[] = {"unsolvable", "solved", "out_of_budget",
+                                 "not_found_at_this_step"};
+    const char *pack = NULL, *out = NULL;
+    struct replay replay;
+    enum result result;
+    int threads = 0, status = 0, opt, steps, i;
+    char *path;
+    double start;
+
+    while ((opt = getopt(argc, argv, "j:m:w:r:s:L:o:")) != -1)
+        switch (opt)
+        {
+            case 'j': threads = atoi(optarg); break;
+            case 'm': BudgetMb = atol(optarg); break;
+            case 'w': Weight = atoi(optarg); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            case 's': StepTicks = atoi(optarg); break;
+            case 'L': pack = optarg; break;
+            case 'o': out = optarg; break;
+            default: Usage();
+        }
+    // A replay starts a numbered level
+    if (optind == argc || BudgetMb < 1 || Weight < 0 || StepTicks < 1
+        || (out && (argc - optind != 1 || LevelIsFile(argv[optind]))))
+        Usage();
+    if (threads < 1)
+        threads = PoolThreads();
+
+    // The tile rules, the built in ones when there is no file
+    if ((i = RulesLoad(RULES_FILE)) > 0)
+        exit(fprintf(stderr, "Bad rule in %s line %d\n", RULES_FILE, i));
+
+    if ((pack ? PackOpen(&Pack, pack) : PackOpenDefault(&Pack)) == 0)
+        LevelPack = &Pack;
+    else
+    if (pack)
+        exit(fprintf(stderr, "Could not read %s\n", pack));
+
+    for (i = optind; i < argc; i++)
+    {
+        if (WorldStartNamed(&Start, argv[i], Seed) < 0)
+            exit(fprintf(stderr, "Could not read level %s\n", argv[i]));
+
+        start = Seconds();
+        path = NULL;
+        result = Solve(threads, &path, &steps);
+        printf("level %s %s steps %d nodes %d expanded %ld mb %.1f "
+            "seconds %.3f\n", argv[i], name[result], steps,
+            atomic_load(&NodeCount) < NodesMax ? atomic_load(&NodeCount)
+                                               : NodesMax,
+            atomic_load(&Expanded), (atomic_load(&ArenaUsed) + (double)
+            atomic_load(&NodeCount) * (sizeof(struct node)
+            + sizeof(struct open))) / 1048576, Seconds() - start);
+
+        if (result == SOLVED)
+        {
+            ReplayStart(&replay, Start.game.current_level, Seed);
+            if (Verify(argv[i], path, out ? &replay : NULL) < 0)
+                exit(fprintf(stderr, "Level %s: the way found does not "
+                    "play back\n", argv[i]));
+            printf("path %s\n", path);
+            if (out && ReplaySave(&replay, out) < 0)
+                exit(fprintf(stderr, "Could not write %s\n", out));
+            ReplayFree(&replay);
+        }
+        free(path);
+        WorldFree(&Start);
+
+        if (result == UNSOLVABLE)
+            status |= 1;
+        if (result == OUT_OF_BUDGET)
+            status |= 2;
+        if (result == NOT_FOUND)
+            status |= 4;
+    }
+
+    return (status & 1) ? 1 : (status & 4) ? 3 : status;
+}
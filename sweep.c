@@ -0,0 +1,215 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <string.h>
+#include "world.h"
+#include "sweep.h"
+
+#if CHUNK_SIZE != 32
+#error "The sweep kernels work on rows of 32 cells"
+#endif
+
+#if !defined(SWEEP_SCALAR) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define SWEEP_X86
+#include <immintrin.h>
+#endif
+
+enum sweep_kind {SWEEP_PLAIN, SWEEP_SSE2, SWEEP_AVX2};
+
+
+/***********
+ * Plain C *
+ ***********/
+static uint32_t MatchPlain(const unsigned char *row, int v)
+{
+    uint32_t bits = 0;
+    int i;
+
+    for (i = 0; i < CHUNK_SIZE; i++)
+        bits |= (uint32_t)(row[i] == v) << i;
+    return bits;
+}
+
+static uint32_t ReplacePlain(unsigned char *row, int from, int to)
+{
+    uint32_t bits = MatchPlain(row, from);
+    int i;
+
+    for (i = 0; i < CHUNK_SIZE; i++)
+        if (bits >> i & 1)
+            row[i] = to;
+    return bits;
+}
+
+
+#ifdef SWEEP_X86
+/********
+ * SSE2 *
+ ********/
+__attribute__((target("sse2")))
+static uint32_t MatchSse2(const unsigned char *row, int v)
+{
+    __m128i key = _mm_set1_epi8(v);
+    __m128i lo = _mm_loadu_si128((const __m128i *)row);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(row + 16));
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, key))
+        | (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, key)) << 16;
+}
+
+__attribute__((target("sse2")))
+static uint32_t ReplaceSse2(unsigned char *row, int from, int to)
+{
+    __m128i key = _mm_set1_epi8(from), put = _mm_set1_epi8(to);
+    __m128i a, eq;
+    uint32_t bits = 0;
+    int k;
+
+    for (k = 0; k < 2; k++)
+    {
+        a = _mm_loadu_si128((const __m128i *)(row + k * 16));
+        eq = _mm_cmpeq_epi8(a, key);
+        a = _mm_or_si128(_mm_andnot_si128(eq, a), _mm_and_si128(eq, put));
+        _mm_storeu_si128((__m128i *)(row + k * 16), a);
+        bits |= (uint32_t)_mm_movemask_epi8(eq) << (k * 16);
+    }
+    return bits;
+}
+
+
+/********
+ * AVX2 *
+ ********/
+__attribute__((target("avx2")))
+static uint32_t MatchAvx2(const unsigned char *row, int v)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)row);
+
+    return (uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(a, _mm256_set1_epi8(v)));
+}
+
+__attribute__((target("avx2")))
+static uint32_t ReplaceAvx2(unsigned char *row, int from, int to)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)row);
+    __m256i eq = _mm256_cmpeq_epi8(a, _mm256_set1_epi8(from));
+
+    _mm256_storeu_si256((__m256i *)row,
+        _mm256_blendv_epi8(a, _mm256_set1_epi8(to), eq));
+    return (uint32_t)_mm256_movemask_epi8(eq);
+}
+#endif
+
+
+/*****************************************************************
+ * The best kernels this CPU can run, picked once before main so *
+ * a row costs an indirect call, not a CPU check and a switch    *
+ *****************************************************************/
+static enum sweep_kind Kind = SWEEP_PLAIN;
+static uint32_t (*MatchRow)(const unsigned char *row, int v) = MatchPlain;
+static uint32_t (*ReplaceRow)(unsigned char *row, int from, int to)
+    = ReplacePlain;
+
+#ifdef SWEEP_X86
+__attribute__((constructor))
+static void SweepPick(void)
+{
+    __builtin_cpu_init(); // Other constructors may not have run yet
+    if (__builtin_cpu_supports("avx2"))
+    {
+        Kind = SWEEP_AVX2;
+        MatchRow = MatchAvx2;
+        ReplaceRow = ReplaceAvx2;
+    } else
+    if (__builtin_cpu_supports("sse2"))
+    {
+        Kind = SWEEP_SSE2;
+        MatchRow = MatchSse2;
+        ReplaceRow = ReplaceSse2;
+    }
+}
+#endif
+
+// Any kind, for SweepCheck
+static uint32_t Match(enum sweep_kind kind, const unsigned char *row, int v)
+{
+    switch (kind)
+    {
+#ifdef SWEEP_X86
+        case SWEEP_AVX2: return MatchAvx2(row, v);
+        case SWEEP_SSE2: return MatchSse2(row, v);
+#endif
+        default: return MatchPlain(row, v);
+    }
+}
+
+static uint32_t Replace(enum sweep_kind kind, unsigned char *row, int from,
+    int to)
+{
+    switch (kind)
+    {
+#ifdef SWEEP_X86
+        case SWEEP_AVX2: return ReplaceAvx2(row, from, to);
+        case SWEEP_SSE2: return ReplaceSse2(row, from, to);
+#endif
+        default: return ReplacePlain(row, from, to);
+    }
+}
+
+uint32_t SweepMatch(const unsigned char *row, int v)
+{
+    return MatchRow(row, v);
+}
+
+uint32_t SweepReplace(unsigned char *row, int from, int to)
+{
+    return ReplaceRow(row, from, to);
+}
+
+const char *SweepName(void)
+{
+    static const char *name[] = {"plain", "sse2", "avx2"};
+
+    return name[Kind];
+}
+
+
+/*********************************************************
+ * Every kernel the CPU has against plain C, random rows *
+ *********************************************************/
+int SweepCheck(long rows)
+{
+    unsigned char row[CHUNK_SIZE], want[CHUNK_SIZE], got[CHUNK_SIZE];
+    uint32_t seed = 1, a, b;
+    int kind, i, v, to, bad = 0;
+    long n;
+
+    for (kind = SWEEP_SSE2; kind <= (int)Kind; kind++)
+        for (n = 0; n < rows; n++)
+        {
+            // Few tile kinds make matches common, flag bits must not
+            for (i = 0; i < CHUNK_SIZE; i++)
+            {
+                seed = seed * 1103515245 + 12345;
+                row[i] = (seed >> 16) % 11;
+                if (n & 1)
+                    row[i] |= (seed >> 8) & 0xf0;
+            }
+            v = n % 11;
+            to = (n / 11) % 16;
+
+            bad += Match(kind, row, v) != MatchPlain(row, v);
+
+            memcpy(want, row, sizeof(row));
+            memcpy(got, row, sizeof(row));
+            a = ReplacePlain(want, v, to);
+            b = Replace(kind, got, v, to);
+            bad += a != b || memcmp(want, got, sizeof(row)) != 0;
+        }
+
+    return bad;
+}
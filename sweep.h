@@ -0,0 +1,21 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+
+/*
+ * Kernels over one row of a chunk's tile plane (CHUNK_SIZE bytes). Bit i
+ * of the result stands for cell i of the row. AVX2 or SSE2 when the CPU
+ * has it, plain C otherwise or when built with -DSWEEP_SCALAR.
+ */
+uint32_t SweepMatch(const unsigned char *row, int v);
+uint32_t SweepReplace(unsigned char *row, int from, int to);
+const char *SweepName(void);
+int SweepCheck(long rows);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tools.h"
+
+
+// Monotonic clock in seconds, for timing only
+double Seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*******************************
+ * Random key, mostly movement *
+ *******************************/
+enum input RandomInput(unsigned *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+
+    switch ((*seed >> 16) % 9)
+    {
+        case 0: case 1: return INPUT_LEFT;
+        case 2: case 3: return INPUT_RIGHT;
+        case 4: case 5: return INPUT_UP;
+        case 6: case 7: return INPUT_DOWN;
+    }
+
+    return INPUT_ACTION;
+}
+
+
+/****************************************************************
+ * Level given by number (from 1) or a .lvl file, at its first  *
+ * tick with the given seed. Files start the way StartLevel     *
+ * starts a level. Returns -1 when there is no such level.      *
+ ****************************************************************/
+int LevelIsFile(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+
+    return dot && !strcmp(dot, ".lvl");
+}
+
+int WorldStartNamed(struct world *world, const char *name, uint32_t seed)
+{
+    if (!LevelIsFile(name))
+    {
+        WorldStart(world, atoi(name) - 1, seed);
+        return world->game.current_level == atoi(name) - 1 ? 0 : -1;
+    }
+
+    WorldInit(world);
+    WorldSeed(world, seed);
+    if (LoadLevelFile(world, name) < 0)
+        return -1;
+    world->game.time = world->game.level_time;
+    world->game.move_time = world->game.level_time;
+    world->game.diamonds = world->game.level_diamonds;
+    world->game.hero_state = FACE1;
+    TrackHero(world);
+    return 0;
+}
@@ -0,0 +1,21 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef TOOLS_H
+#define TOOLS_H
+
+#include "world.h"
+
+/*
+ * What the headless tools (batch, bench, solve, render, fuzz) share: the
+ * clock they time with, the random keys they play, and the levels named
+ * on their command lines. The game itself uses none of it.
+ */
+double Seconds(void);
+enum input RandomInput(unsigned *seed);
+int LevelIsFile(const char *name);
+int WorldStartNamed(struct world *world, const char *name, uint32_t seed);
+
+#endif
@@ -0,0 +1,1780 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "world.h"
+#include "pack.h"
+#include "sweep.h"
+#include "bitboard.h"
+#include "profile.h"
+#include "rules.h"
+
+
+/*****************
+ * Board storage *
+ *****************/
+static int Inside(struct world *world, int h, int w)
+{
+    return h > 0 && h < world->height - 1 && w > 0 && w < world->width - 1;
+}
+
+static struct chunk *ChunkAt(struct world *world, int h, int w)
+{
+    return world->chunks[(h >> CHUNK_BITS) * world->chunks_x
+                         + (w >> CHUNK_BITS)];
+}
+
+// Chunk of the cell and its index k in the planes, NULL outside or in a
+// chunk not yet allocated
+static struct chunk *Cell(struct world *world, int h, int w, int *k)
+{
+    if (h < 0 || w < 0 || h >= world->height || w >= world->width)
+        return NULL;
+    *k = (h & CHUNK_MASK) << CHUNK_BITS | (w & CHUNK_MASK);
+    return ChunkAt(world, h, w);
+}
+
+// Cell to be changed, allocates its chunk on demand (NULL outside)
+static struct chunk *NewCell(struct world *world, int h, int w, int *k)
+{
+    struct chunk **c;
+
+    if (h < 0 || w < 0 || h >= world->height || w >= world->width)
+        return NULL;
+    c = &world->chunks[(h >> CHUNK_BITS) * world->chunks_x
+                       + (w >> CHUNK_BITS)];
+    if (!*c)
+    {
+        if (!(*c = calloc(1, sizeof(struct chunk))))
+            exit(fprintf(stderr, "Out of memory\n"));
+        memset((*c)->tile, world->fill, sizeof((*c)->tile));
+        (*c)->changed = 1;
+    }
+    *k = (h & CHUNK_MASK) << CHUNK_BITS | (w & CHUNK_MASK);
+    return *c;
+}
+
+// Columns of chunk column cx inside the board, one bit each
+static uint32_t Columns(struct world *world, int cx)
+{
+    int n = world->width - (cx << CHUNK_BITS);
+
+    return n >= CHUNK_SIZE ? ~(uint32_t)0 : ((uint32_t)1 << n) - 1;
+}
+
+// The same without the border columns
+static uint32_t Inner(struct world *world, int cx)
+{
+    uint32_t bits = Columns(world, cx);
+    int last = world->width - 1 - (cx << CHUNK_BITS);
+
+    if (cx == 0)
+        bits &= ~(uint32_t)1;
+    if (last >= 0 && last < CHUNK_SIZE)
+        bits &= ~((uint32_t)1 << last);
+    return bits;
+}
+
+// Cells h, w.. up to the end of the chunk (n of them), NULL if all fill
+const unsigned char *BoardSpan(struct world *world, int h, int w, int *n)
+{
+    struct chunk *c;
+    int k;
+
+    *n = CHUNK_SIZE - (w & CHUNK_MASK);
+    if (*n > world->width - w)
+        *n = world->width - w;
+    c = Cell(world, h, w, &k);
+    return c ? &c->tile[k] : NULL;
+}
+
+// The same cells in the flags plane, NULL if no flags set
+const unsigned char *FlagsSpan(struct world *world, int h, int w, int *n)
+{
+    struct chunk *c;
+    int k;
+
+    if (!BoardSpan(world, h, w, n))
+        return NULL;
+    c = Cell(world, h, w, &k);
+    return &c->flags[k];
+}
+
+/************************************************************************
+ * Zobrist keys, made up from the position so no table is needed. The  *
+ * hash is relative to the empty board: cells holding the fill tile    *
+ * with no flags count as nothing, so a new board hashes in O(1).      *
+ ************************************************************************/
+static uint64_t Mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull; // splitmix64 finalizer
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Key of a cell holding byte (tile | flags)
+static uint64_t CellKey(int h, int w, int byte)
+{
+    return Mix(((uint64_t)h << 24 | (uint64_t)w << 8 | byte)
+        + 0x9e3779b97f4a7c15ull);
+}
+
+// Cell h, w changed from byte a to byte b
+static void HashCell(struct world *world, int h, int w, int a, int b)
+{
+    world->hash ^= CellKey(h, w, a) ^ CellKey(h, w, b);
+}
+
+// Hash of the board kept up to date by every change, O(1)
+uint64_t BoardHash(struct world *world)
+{
+    return world->hash;
+}
+
+// Hash of a new board (only the fill tile)
+static uint64_t EmptyHash(struct world *world)
+{
+    return Mix((uint64_t)1 << 63 | (uint64_t)world->width << 32
+        | (uint64_t)world->height << 8 | world->fill);
+}
+
+// The same from scratch, to check BoardHash
+uint64_t BoardHashFull(struct world *world)
+{
+    uint64_t hash = EmptyHash(world);
+    struct chunk *c;
+    int j, i, k, b;
+
+    for (j = 0; j < world->height; j++)
+        for (i = 0; i < world->width; i++)
+            if (!(c = Cell(world, j, i, &k)))
+                i |= CHUNK_MASK;
+            else
+            if ((b = c->tile[k] | c->flags[k]) != world->fill)
+                hash ^= CellKey(j, i, b) ^ CellKey(j, i, world->fill);
+    return hash;
+}
+
+void BoardFree(struct world *world)
+{
+    int k;
+
+    for (k = 0; k < world->chunks_x * world->chunks_y; k++)
+        if (world->chunks[k])
+        {
+            free(world->chunks[k]->slot);
+            free(world->chunks[k]);
+        }
+    free(world->chunks);
+    free(world->band_active);
+    world->chunks = NULL;
+    world->band_active = NULL;
+    world->width = world->height = world->chunks_x = world->chunks_y = 0;
+    for (k = 0; k < ENTITY_KINDS; k++)
+        world->entities[k].count = 0;
+    world->moved.count = 0;
+}
+
+
+// Kind of entity of each tile, -1 for the tiles not in the registry
+static const signed char EntityKind[16] = {-1, -1, ENTITY_HERO, -1, -1, -1,
+    -1, ENTITY_BOX, ENTITY_DOOR, ENTITY_FLY, -1, -1, -1, -1, -1, -1};
+
+
+/***************************************************
+ * New empty board, every cell holds the fill tile *
+ ***************************************************/
+int BoardResize(struct world *world, int width, int height, int fill)
+{
+    BoardFree(world);
+    if (width < 1 || height < 1 || width > LEVELS_MAX || height > LEVELS_MAX)
+        return -1;
+    // Chunks not allocated hold no entities, see RebuildEntities
+    if (EntityKind[fill & 15] >= 0)
+        return -1;
+
+    world->width = width;
+    world->height = height;
+    world->fill = fill & 15;
+    world->generation++;
+    world->chunks_x = (width + CHUNK_MASK) >> CHUNK_BITS;
+    world->chunks_y = (height + CHUNK_MASK) >> CHUNK_BITS;
+    world->chunks = calloc(world->chunks_x * world->chunks_y,
+        sizeof(struct chunk *));
+    world->band_active = calloc(world->chunks_y, sizeof(int));
+    if (!world->chunks || !world->band_active)
+        exit(fprintf(stderr, "Out of memory\n"));
+    world->hash = EmptyHash(world);
+    return 0;
+}
+
+
+/******************************************
+ * Entity registry (heroes, doors, boxes) *
+ ******************************************/
+static void EntityPush(struct entities *e, int pos)
+{
+    if (e->count == e->alloc)
+    {
+        e->alloc = e->alloc ? e->alloc * 2 : 16;
+        if (!(e->pos = realloc(e->pos, e->alloc * sizeof(int))))
+            exit(fprintf(stderr, "Out of memory\n"));
+    }
+    e->pos[e->count++] = pos;
+}
+
+static int *Slot(struct world *world, int h, int w)
+{
+    struct chunk *c = ChunkAt(world, h, w);
+
+    if (!c->slot
+        && !(c->slot = malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(int))))
+        exit(fprintf(stderr, "Out of memory\n"));
+    return &c->slot[(h & CHUNK_MASK) * CHUNK_SIZE + (w & CHUNK_MASK)];
+}
+
+static void EntityAdd(struct world *world, int kind, int h, int w)
+{
+    struct entities *e = &world->entities[kind];
+
+    *Slot(world, h, w) = e->count;
+    EntityPush(e, h * world->width + w);
+}
+
+static void EntityRemove(struct world *world, int kind, int h, int w)
+{
+    struct entities *e = &world->entities[kind];
+    int last = e->pos[--e->count];
+    int slot = *Slot(world, h, w);
+
+    // The last one takes the free slot
+    e->pos[slot] = last;
+    *Slot(world, last / world->width, last % world->width) = slot;
+}
+
+void RebuildEntities(struct world *world)
+{
+    static const int tile[ENTITY_KINDS] = {HERO, DOOR, BOX, FLY};
+    struct chunk *c;
+    uint32_t bits;
+    int j, cx, k;
+
+    for (k = 0; k < ENTITY_KINDS; k++)
+        world->entities[k].count = 0;
+
+    // Row by row, so every list is in reading order
+    for (j = 1; j < world->height - 1; j++)
+        for (cx = 0; cx < world->chunks_x; cx++)
+        {
+            if (!(c = world->chunks[(j >> CHUNK_BITS) * world->chunks_x + cx]))
+                continue; // Empty chunk, only the fill tile
+            for (k = 0; k < ENTITY_KINDS; k++)
+                for (bits = Inner(world, cx) & SweepMatch(
+                         &c->tile[(j & CHUNK_MASK) << CHUNK_BITS], tile[k]);
+                     bits; bits &= bits - 1)
+                    EntityAdd(world, k, j,
+                        (cx << CHUNK_BITS) + __builtin_ctz(bits));
+        }
+}
+
+
+/*****************************************************************
+ * Active set of rocks and diamonds. A cell that MoveRocks could *
+ * change is always in the set; a change of a tile wakes every   *
+ * rock whose move depends on it (the cell, its sides, and the   *
+ * cells above them). Extra cells in the set only cost the visit. *
+ *****************************************************************/
+static void Activate(struct world *world, int h, int w)
+{
+    struct chunk *c;
+    uint32_t bit = (uint32_t)1 << (w & CHUNK_MASK);
+
+    if (!Inside(world, h, w) || !(c = ChunkAt(world, h, w)))
+        return; // Only the fill tile there, nothing can move
+    if (!(c->active[h & CHUNK_MASK] & bit))
+    {
+        c->active[h & CHUNK_MASK] |= bit;
+        world->band_active[h >> CHUNK_BITS]++;
+    }
+}
+
+static void Deactivate(struct world *world, int h, int w)
+{
+    struct chunk *c = ChunkAt(world, h, w);
+    uint32_t bit = (uint32_t)1 << (w & CHUNK_MASK);
+
+    if (c->active[h & CHUNK_MASK] & bit)
+    {
+        c->active[h & CHUNK_MASK] &= ~bit;
+        world->band_active[h >> CHUNK_BITS]--;
+    }
+}
+
+static void Wake(struct world *world, int h, int w)
+{
+    Activate(world, h, w - 1);
+    Activate(world, h, w);
+    Activate(world, h, w + 1);
+    Activate(world, h - 1, w - 1);
+    Activate(world, h - 1, w);
+    Activate(world, h - 1, w + 1);
+}
+
+void WakeAll(struct world *world)
+{
+    struct chunk *c;
+    uint32_t bits;
+    int j, cx;
+
+    for (j = 1; j < world->height - 1; j++)
+        for (cx = 0; cx < world->chunks_x; cx++)
+            if ((c = world->chunks[(j >> CHUNK_BITS) * world->chunks_x + cx]))
+            {
+                bits = Inner(world, cx) & ~c->active[j & CHUNK_MASK];
+                c->active[j & CHUNK_MASK] |= bits;
+                world->band_active[j >> CHUNK_BITS]
+                    += __builtin_popcount(bits);
+            }
+}
+
+static uint32_t ActiveBits(struct world *world, int h, int k)
+{
+    struct chunk *c = world->chunks[(h >> CHUNK_BITS) * world->chunks_x + k];
+
+    return c ? c->active[h & CHUNK_MASK] : 0;
+}
+
+// First active cell at or after w in row h, -1 if none
+static int NextActive(struct world *world, int h, int w)
+{
+    int k = w >> CHUNK_BITS;
+    uint32_t bits = ActiveBits(world, h, k)
+        & (~(uint32_t)0 << (w & CHUNK_MASK));
+
+    while (!bits)
+    {
+        if (++k == world->chunks_x)
+            return -1;
+        bits = ActiveBits(world, h, k);
+    }
+    return (k << CHUNK_BITS) + __builtin_ctz(bits);
+}
+
+// Last active cell at or before w in row h, -1 if none
+static int PrevActive(struct world *world, int h, int w)
+{
+    int k = w >> CHUNK_BITS;
+    uint32_t bits = ActiveBits(world, h, k)
+        & (~(uint32_t)0 >> (CHUNK_MASK - (w & CHUNK_MASK)));
+
+    while (!bits)
+    {
+        if (--k < 0)
+            return -1;
+        bits = ActiveBits(world, h, k);
+    }
+    return (k << CHUNK_BITS) + 31 - __builtin_clz(bits);
+}
+
+
+/*********************************************
+ * Access (get/set) to game board properties *
+ *********************************************/
+int GetBoard(struct world *world, int h, int w)
+{
+    int k;
+    struct chunk *c = Cell(world, h, w, &k);
+
+    if (!c) // Outside of the board everything is solid
+        return (h < 0 || w < 0 || h >= world->height || w >= world->width)
+            ? METAL : world->fill;
+    return c->tile[k];
+}
+
+void SetBoard(struct world *world, int h, int w, int v)
+{
+    struct chunk *c;
+    int k, old;
+
+    v &= 15;
+    if ((old = GetBoard(world, h, w)) == v || !(c = NewCell(world, h, w, &k)))
+        return;
+
+    if (Inside(world, h, w))
+    {
+        if (EntityKind[old] >= 0)
+            EntityRemove(world, EntityKind[old], h, w);
+        if (EntityKind[v] >= 0)
+            EntityAdd(world, EntityKind[v], h, w);
+    }
+    c->crashes += (v == CRASH) - (old == CRASH);
+    c->changed = 1;
+    HashCell(world, h, w, old | c->flags[k], v | c->flags[k]);
+    c->tile[k] = v;
+    if (world->bitboard.rows)
+        BitboardTile(world, h, w, 1, old, v);
+    Wake(world, h, w);
+}
+
+/*
+ * Bulk loading of a new board: BoardPut writes the tile only, then
+ * BoardSettle brings the entities, the active set and the crash counts
+ * up to date at once.
+ */
+void BoardPut(struct world *world, int h, int w, int v)
+{
+    struct chunk *c;
+    int k;
+
+    v &= 15;
+    if (GetBoard(world, h, w) != v && (c = NewCell(world, h, w, &k)))
+    {
+        HashCell(world, h, w, c->tile[k] | c->flags[k], v | c->flags[k]);
+        c->tile[k] = v;
+        c->changed = 1;
+    }
+}
+
+void BoardSettle(struct world *world)
+{
+    struct chunk *c;
+    int cy, cx, j;
+
+    for (cy = 0; cy < world->chunks_y; cy++)
+        for (cx = 0; cx < world->chunks_x; cx++)
+        {
+            if (!(c = world->chunks[cy * world->chunks_x + cx]))
+                continue;
+            c->crashes = 0;
+            for (j = 0; j < CHUNK_SIZE
+                && (cy << CHUNK_BITS) + j < world->height; j++)
+                c->crashes += __builtin_popcount(Columns(world, cx)
+                    & SweepMatch(&c->tile[j << CHUNK_BITS], CRASH));
+        }
+
+    RebuildEntities(world);
+    WakeAll(world);
+}
+
+// Flag bits of a cell, 0 where nothing was set
+static int GetFlags(struct world *world, int h, int w, int mask)
+{
+    int k;
+    struct chunk *c = Cell(world, h, w, &k);
+
+    return c ? c->flags[k] & mask : 0;
+}
+
+static void SetFlags(struct world *world, int h, int w, int mask, int v)
+{
+    struct chunk *c;
+    int k;
+
+    if ((c = NewCell(world, h, w, &k)))
+    {
+        v = (c->flags[k] & ~mask) | (v & mask);
+        HashCell(world, h, w, c->tile[k] | c->flags[k], c->tile[k] | v);
+        c->flags[k] = v;
+        c->changed = 1;
+    }
+}
+
+int GetRockMove(struct world *world, int h, int w)
+{
+    return GetFlags(world, h, w, FLAG_ROCK_MOVE) ? MOVING : STILL;
+}
+
+void SetRockMove(struct world *world, int h, int w, int v)
+{
+    if (GetRockMove(world, h, w) == v)
+        return;
+    SetFlags(world, h, w, FLAG_ROCK_MOVE, v == MOVING ? FLAG_ROCK_MOVE : 0);
+    if (world->bitboard.rows)
+        BitboardMoving(world, h, w, v);
+    if (v == MOVING)
+        Activate(world, h, w);
+}
+
+int GetBoxMove(struct world *world, int h, int w)
+{
+    return GetFlags(world, h, w, FLAG_BOX_MOVE) ? MOVING : STILL;
+}
+
+void SetBoxMove(struct world *world, int h, int w, int v)
+{
+    if (GetBoxMove(world, h, w) == v)
+        return;
+    SetFlags(world, h, w, FLAG_BOX_MOVE, v == MOVING ? FLAG_BOX_MOVE : 0);
+}
+
+int GetBoxDir(struct world *world, int h, int w)
+{
+    return GetFlags(world, h, w, FLAG_BOX_DIR) >> FLAG_BOX_DIR_SHIFT;
+}
+
+void SetBoxDir(struct world *world, int h, int w, int v)
+{
+    if (GetBoxDir(world, h, w) == v)
+        return;
+    SetFlags(world, h, w, FLAG_BOX_DIR, v << FLAG_BOX_DIR_SHIFT);
+}
+
+
+/*****************************************
+ * Read one line of any length (no '\n') *
+ *****************************************/
+static char *ReadLine(FILE *fp, char **line, size_t *alloc)
+{
+    size_t n = 0;
+    int ch;
+
+    while ((ch = getc(fp)) != EOF && ch != '\n')
+    {
+        if (n + 1 >= *alloc)
+        {
+            *alloc = *alloc ? *alloc * 2 : 256;
+            if (!(*line = realloc(*line, *alloc)))
+                exit(fprintf(stderr, "Out of memory\n"));
+        }
+        (*line)[n++] = ch;
+    }
+    if (ch == EOF && n == 0)
+        return NULL;
+    if (n && (*line)[n - 1] == '\r')
+        n--;
+    if (!*line && !(*line = malloc(*alloc = 256)))
+        exit(fprintf(stderr, "Out of memory\n"));
+    (*line)[n] = 0;
+    return *line;
+}
+
+
+/*****************
+ * Loading level *
+ *****************/
+// Any stream rewind works on (a file, a level in memory), read twice
+int LoadLevelStream(struct world *world, FILE *fp)
+{
+    char *line = NULL;
+    size_t alloc = 0;
+    int i = 0, j = 0, width = 0, height = 0, fill = METAL, len;
+
+    // The size is given by .w and .h, or by the first row and row count
+    while (ReadLine(fp, &line, &alloc) != NULL)
+    {
+        if (line[0] == '#' || line[0] == 0)
+            continue;
+        if (line[0] == '.')
+        {
+            if (line[1] == 'd' && line[2] == '=')
+                world->game.level_diamonds = atoi(line + 3);
+            else
+            if (line[1] == 't' && line[2] == '=')
+                world->game.level_time = atoi(line + 3);
+            else
+            if (line[1] == 'w' && line[2] == '=')
+                width = atoi(line + 3);
+            else
+            if (line[1] == 'h' && line[2] == '=')
+                height = atoi(line + 3);
+            else
+            if (line[1] == 'f' && line[2] == '=')
+                fill = atoi(line + 3);
+            continue;
+        }
+
+        if (!width)
+            width = strlen(line);
+        j++;
+    }
+    if (!height)
+        height = j;
+
+    if (BoardResize(world, width, height, fill) < 0)
+    {
+        free(line);
+        return -1;
+    }
+
+    // Second pass fills the board, missing cells keep the fill tile
+    rewind(fp);
+    j = 0;
+    while (j < height && ReadLine(fp, &line, &alloc) != NULL)
+    {
+        if (line[0] == '#' || line[0] == 0 || line[0] == '.')
+            continue;
+
+        len = strlen(line);
+        for (i = 0; i < width && i < len; i++)
+            BoardPut(world, j, i, line[i] - 48);
+        j++;
+    }
+    BoardSettle(world);
+
+    free(line);
+    return 0;
+}
+
+int LoadLevelFile(struct world *world, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    int result;
+
+    if (fp == NULL)
+        return -1;
+    result = LoadLevelStream(world, fp);
+    fclose(fp);
+    return result;
+}
+
+int LoadLevel(struct world *world, int level)
+{
+    char path[32];
+
+    if (LevelPack)
+        return PackLoad(LevelPack, world, level);
+
+    snprintf(path, sizeof(path), LEVEL_FILE, level + 1);
+    return LoadLevelFile(world, path);
+}
+
+
+/*****************************************************************
+ * Level cache: the board of every level as it was loaded, so a  *
+ * restart, a death or a level change is a copy, not a file read *
+ *****************************************************************/
+static void LevelSave(struct world *world, struct level_copy *copy)
+{
+    int n = world->chunks_x * world->chunks_y, k;
+    struct entities *e;
+
+    copy->width = world->width;
+    copy->height = world->height;
+    copy->fill = world->fill;
+    copy->diamonds = world->game.level_diamonds;
+    copy->time = world->game.level_time;
+    copy->hash = world->hash;
+    copy->chunks = calloc(n, sizeof(struct chunk *));
+    copy->band_active = malloc(world->chunks_y * sizeof(int));
+    if (!copy->chunks || !copy->band_active)
+        exit(fprintf(stderr, "Out of memory\n"));
+    memcpy(copy->band_active, world->band_active,
+        world->chunks_y * sizeof(int));
+
+    for (k = 0; k < n; k++)
+        if (world->chunks[k])
+        {
+            if (!(copy->chunks[k] = malloc(sizeof(struct chunk))))
+                exit(fprintf(stderr, "Out of memory\n"));
+            *copy->chunks[k] = *world->chunks[k];
+            copy->chunks[k]->slot = NULL;
+        }
+
+    for (k = 0; k < ENTITY_KINDS; k++)
+    {
+        e = &copy->entities[k];
+        e->count = e->alloc = world->entities[k].count;
+        if (!e->count)
+            continue;
+        if (!(e->pos = malloc(e->count * sizeof(int))))
+            exit(fprintf(stderr, "Out of memory\n"));
+        memcpy(e->pos, world->entities[k].pos, e->count * sizeof(int));
+    }
+}
+
+static void LevelRestore(struct world *world, struct level_copy *copy)
+{
+    struct chunk *c;
+    struct entities *e;
+    int n, k, i, *slot;
+
+    // A board of the same size keeps its chunks, only the cells change
+    if (world->width != copy->width || world->height != copy->height
+        || world->fill != copy->fill)
+        BoardResize(world, copy->width, copy->height, copy->fill);
+    else
+        world->generation++;
+
+    n = world->chunks_x * world->chunks_y;
+    for (k = 0; k < n; k++)
+    {
+        c = world->chunks[k];
+        if (!copy->chunks[k])
+        {
+            if (c)
+            {
+                free(c->slot);
+                free(c);
+                world->chunks[k] = NULL;
+            }
+            continue;
+        }
+
+        slot = c ? c->slot : NULL;
+        if (!c && !(c = malloc(sizeof(struct chunk))))
+            exit(fprintf(stderr, "Out of memory\n"));
+        *c = *copy->chunks[k];
+        c->slot = slot;
+        c->changed = 1;
+        world->chunks[k] = c;
+    }
+    memcpy(world->band_active, copy->band_active,
+        world->chunks_y * sizeof(int));
+
+    for (k = 0; k < ENTITY_KINDS; k++)
+    {
+        e = &world->entities[k];
+        e->count = 0;
+        for (i = 0; i < copy->entities[k].count; i++)
+            EntityAdd(world, k, copy->entities[k].pos[i] / world->width,
+                copy->entities[k].pos[i] % world->width);
+    }
+    world->moved.count = 0;
+    world->order.count = 0;
+
+    world->game.level_diamonds = copy->diamonds;
+    world->game.level_time = copy->time;
+    world->hash = copy->hash;
+}
+
+// Board of the level from the cache, from the disk the first time only
+static int LevelLoad(struct world *world, int level)
+{
+    struct level_copy *copy;
+    int alloc;
+
+    if (level < 0 || level >= LEVELS_CACHED)
+        return LoadLevel(world, level);
+
+    if (level >= world->levels_alloc)
+    {
+        alloc = world->levels_alloc ? world->levels_alloc : 32;
+        while (alloc <= level)
+            alloc *= 2;
+        world->levels = realloc(world->levels,
+            alloc * sizeof(struct level_copy));
+        if (!world->levels)
+            exit(fprintf(stderr, "Out of memory\n"));
+        memset(world->levels + world->levels_alloc, 0,
+            (alloc - world->levels_alloc) * sizeof(struct level_copy));
+        world->levels_alloc = alloc;
+    }
+
+    copy = &world->levels[level];
+    if (!copy->state)
+    {
+        copy->state = LoadLevel(world, level) < 0 ? -1 : 1;
+        if (copy->state > 0)
+            LevelSave(world, copy);
+        return copy->state > 0 ? 0 : -1;
+    }
+    if (copy->state < 0)
+        return -1;
+
+    LevelRestore(world, copy);
+    return 0;
+}
+
+static void LevelCacheFree(struct world *world)
+{
+    struct level_copy *copy;
+    int i, k;
+
+    for (i = 0; i < world->levels_alloc; i++)
+    {
+        copy = &world->levels[i];
+        if (copy->state <= 0)
+            continue;
+        for (k = 0; k < ((copy->width + CHUNK_MASK) >> CHUNK_BITS)
+            * ((copy->height + CHUNK_MASK) >> CHUNK_BITS); k++)
+            free(copy->chunks[k]);
+        free(copy->chunks);
+        free(copy->band_active);
+        for (k = 0; k < ENTITY_KINDS; k++)
+            free(copy->entities[k].pos);
+    }
+    free(world->levels);
+    world->levels = NULL;
+    world->levels_alloc = 0;
+}
+
+
+/**************************************
+ * This function starts the new board *
+ **************************************/
+void StartLevel(struct world *world, int new_level)
+{
+    // A missing level takes the game back to the first one
+    if (LevelLoad(world, new_level) < 0 && world->game.current_level != 0)
+    {
+        world->game.current_level = 0;
+        LevelLoad(world, world->game.current_level);
+    }
+    world->game.time = world->game.level_time;
+    world->game.move_time = world->game.level_time;
+    world->game.diamonds = world->game.level_diamonds;
+    world->game.hero_state = FACE1;
+}
+
+
+/*****************************************************************
+ * Set the sound to be play; all of those of one tick are played *
+ *****************************************************************/
+void SoundRequest(struct world *world, int sound)
+{
+    world->game.sound_to_play = sound;
+    world->sounds |= 1u << sound;
+}
+
+
+/******************
+ * Make the crash *
+ ******************/
+void MakeCrash(struct world *world, int object, int y, int x)
+{
+    int j, i;
+
+    for (j = y - 1; j <= y + 1; j++)
+        for (i = x - 1; i <= x + 1; i++)
+            if (!RULE(immune, GetBoard(world, j, i)))
+                SetBoard(world, j, i, object);
+
+    SoundRequest(world, SOUND_EXPLOSION);
+}
+
+
+/********************
+ * Remove the crash *
+ ********************/
+void CrashRemove(struct world *world)
+{
+    struct chunk *c;
+    uint32_t bits, columns;
+    unsigned char *row;
+    int cy, cx, j, h, i;
+
+    // Chunk by chunk, only where SetBoard counted some crash
+    for (cy = world->chunks_y - 1; cy >= 0; cy--)
+        for (cx = 0; cx < world->chunks_x; cx++)
+        {
+            c = world->chunks[cy * world->chunks_x + cx];
+            if (!c || !c->crashes)
+                continue;
+            columns = Columns(world, cx);
+            for (j = CHUNK_MASK; j >= 0; j--)
+            {
+                h = (cy << CHUNK_BITS) + j;
+                if (h <= 0 || h >= world->height - 1)
+                    continue;
+
+                // A whole row at once; past the board's edge one by one
+                row = &c->tile[j << CHUNK_BITS];
+                if (columns == ~(uint32_t)0)
+                    bits = SweepReplace(row, CRASH, TUNNEL);
+                else
+                {
+                    bits = SweepMatch(row, CRASH) & columns;
+                    for (i = 0; i < CHUNK_SIZE; i++)
+                        if (bits >> i & 1)
+                            row[i] = TUNNEL;
+                }
+                if (!bits)
+                    continue;
+
+                // What SetBoard would do for each, CRASH is no entity
+                c->crashes -= __builtin_popcount(bits);
+                c->changed = 1;
+                if (world->bitboard.rows)
+                    BitboardTile(world, h, cx << CHUNK_BITS, bits, CRASH,
+                        TUNNEL);
+                for (; bits; bits &= bits - 1)
+                {
+                    i = __builtin_ctz(bits);
+                    HashCell(world, h, (cx << CHUNK_BITS) + i,
+                        CRASH | c->flags[(j << CHUNK_BITS) + i],
+                        TUNNEL | c->flags[(j << CHUNK_BITS) + i]);
+                    Wake(world, h, (cx << CHUNK_BITS) + i);
+                }
+            }
+        }
+}
+
+
+/***************************************************
+ * This function control each other box and fly AI *
+ ***************************************************/
+static int MoveBox(struct world *world, int j, int i, int d)
+{
+    int dj = j, di = i;
+
+    if (d > WEST)
+        d -= (WEST + 1);
+    if (d < NORTH)
+        d = WEST;
+
+    switch (d)
+    {
+        case NORTH: dj -= 1; break;
+        case EAST:  di += 1; break;
+        case SOUTH: dj += 1; break;
+        case WEST:  di -= 1; break;
+    }
+
+    if (GetBoard(world, dj, di) == HERO)
+    {
+        MakeCrash(world, Rules.crash[GetBoard(world, j, i)], dj, di);
+        return 1;
+    }
+
+    if (GetBoard(world, dj, di) == TUNNEL)
+    {
+        SetBoard(world, dj, di, GetBoard(world, j, i));
+        SetBoard(world, j, i, TUNNEL);
+        SetBoxMove(world, dj, di, MOVING);
+        SetBoxDir(world, dj, di, d);
+        EntityPush(&world->moved, dj * world->width + di);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**********************************************
+ * This function control boxs's and flys's AI *
+ **********************************************/
+static int BoxOrder(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// Sort key of the sweep order: bottom row first, left to right in the row
+static int BoxKey(struct world *world, int pos)
+{
+    return (world->height - 1 - pos / world->width) * world->width
+        + pos % world->width;
+}
+
+void MoveBoxes(struct world *world)
+{
+    struct entities *box = &world->entities[ENTITY_BOX];
+    struct entities *fly = &world->entities[ENTITY_FLY];
+    struct entities *order = &world->order;
+    int k, j, i, d;
+
+    // Only the boxes and flies moved last time can be marked MOVING
+    for (k = 0; k < world->moved.count; k++)
+    {
+        j = world->moved.pos[k] / world->width;
+        i = world->moved.pos[k] % world->width;
+        if (Inside(world, j, i))
+            SetBoxMove(world, j, i, STILL);
+    }
+    world->moved.count = 0;
+
+    order->count = 0;
+    for (k = 0; k < box->count; k++)
+        EntityPush(order, BoxKey(world, box->pos[k]));
+    for (k = 0; k < fly->count; k++)
+        EntityPush(order, BoxKey(world, fly->pos[k]));
+    if (order->count)
+        qsort(order->pos, order->count, sizeof(int), BoxOrder);
+
+    for (k = 0; k < order->count; k++)
+    {
+        j = world->height - 1 - order->pos[k] / world->width;
+        i = order->pos[k] % world->width;
+        if ((GetBoard(world, j, i) == BOX || GetBoard(world, j, i) == FLY)
+            && GetBoxMove(world, j, i) == STILL)
+        {
+            for (d = GetBoxDir(world, j, i) - 1;
+                 d <= GetBoxDir(world, j, i) + 2; d++)
+                if (MoveBox(world, j, i, d))
+                    break;
+        }
+    }
+}
+
+
+/*******************************************
+ * Falling rock and diamonds on given side *
+ *******************************************/
+static int SideFree(struct world *world, int j, int i, int side)
+{
+    return GetBoard(world, j, i + side) == TUNNEL
+        && GetBoard(world, j + 1, i + side) == TUNNEL;
+}
+
+static void FallingOnSide(struct world *world, int j, int i, int side)
+{
+    if (SideFree(world, j, i, side))
+    {
+        SetBoard(world, j, i + side, GetBoard(world, j, i));
+        SetBoard(world, j, i, TUNNEL);
+        SetRockMove(world, j, i + side, MOVING);
+    }
+}
+
+
+/*********************************************************
+ * Can the rock or diamond do anything on the next sweep *
+ *********************************************************/
+static int RockActive(struct world *world, int j, int i)
+{
+    int o = GetBoard(world, j, i), b = GetBoard(world, j + 1, i);
+
+    if (!RULE(falls, o))
+        return 0;
+    if (GetRockMove(world, j, i) == MOVING)
+        return 1;
+    if (b == TUNNEL || RULE(explosive, b))
+        return 1;
+
+    return RULE(solid, b) && (SideFree(world, j, i, FALL_LEFT)
+                              || SideFree(world, j, i, FALL_RIGHT));
+}
+
+
+/***********************************
+ * Move the single rock or diamond *
+ ***********************************/
+void MoveRock(struct world *world, int j, int i)
+{
+    int b = GetBoard(world, j + 1, i);
+
+    // Falling rock or diamond on right or left
+    if (RULE(solid, b) && (SideFree(world, j, i, FALL_LEFT)
+                           || SideFree(world, j, i, FALL_RIGHT)))
+    {
+        if (WorldRandom(world) >> 31)
+            FallingOnSide(world, j, i, FALL_RIGHT);
+        else
+            FallingOnSide(world, j, i, FALL_LEFT);
+    } else
+    if (b == TUNNEL) // Falling down
+    {
+        SetBoard(world, j + 1, i, GetBoard(world, j, i));
+        SetBoard(world, j, i, TUNNEL);
+        SetRockMove(world, j + 1, i, MOVING);
+    } else
+    // Or it kills the player when falling, the BOX always
+    if ((b == HERO && GetRockMove(world, j, i) == MOVING)
+        || RULE(explosive, b))
+        MakeCrash(world, Rules.crash[b], j + 1, i);
+
+    SetRockMove(world, j, i, STILL);
+}
+
+
+/***************************************************
+ * This function control rock and diamonds falling *
+ ***************************************************/
+void MoveRocks(struct world *world)
+{
+    int band, j, i;
+
+    // Same serpentine order as the full scan, only over the active set.
+    // The set is read live, so rocks rolling ahead are visited again.
+    for (band = world->chunks_y - 1; band >= 0; band--)
+    {
+        if (!world->band_active[band])
+            continue;
+        for (j = (band << CHUNK_BITS) + CHUNK_MASK; j >= band << CHUNK_BITS;
+             j--)
+        {
+            if (j < 1 || j > world->height - 2)
+                continue;
+            for (i = (j % 2) ? PrevActive(world, j, world->width - 2)
+                             : NextActive(world, j, 1);
+                 i > 0 && i < world->width - 1;
+                 i = (j % 2) ? PrevActive(world, j, i - 1)
+                             : NextActive(world, j, i + 1))
+            {
+                if (RULE(falls, GetBoard(world, j, i)))
+                    MoveRock(world, j, i);
+                if (!RockActive(world, j, i))
+                    Deactivate(world, j, i);
+            }
+        }
+    }
+}
+
+
+/********************************************
+ * Reference version: sweep the whole board *
+ ********************************************/
+void MoveRocksScan(struct world *world)
+{
+    int j, i;
+
+    for (j = world->height - 2; j > 0; j--)
+        for (i = (j % 2) ? world->width - 2 : 1;
+             (j % 2) ? i > 0 : i < world->width - 1;
+             (j % 2) ? i-- : i++)
+        {
+            if (RULE(falls, GetBoard(world, j, i)))
+                MoveRock(world, j, i);
+        }
+}
+
+
+/**********************************
+ * This function finds the object *
+ **********************************/
+int FindObject(struct world *world, int object, int *y, int *x)
+{
+    struct entities *e;
+    struct chunk *c;
+    uint32_t bits;
+    int j, k, p;
+
+    if (object == (object & 15) && EntityKind[object] >= 0)
+    {
+        // First one in reading order, as the scan below would find
+        e = &world->entities[(int)EntityKind[object]];
+        if (!e->count)
+            return (-1); // Object not found
+        for (p = e->pos[0], k = 1; k < e->count; k++)
+            if (e->pos[k] < p)
+                p = e->pos[k];
+        if (y != 0)
+            *y = p / world->width;
+        if (x != 0)
+            *x = p % world->width;
+        return object; // Object found
+    }
+
+    // A row of a chunk at a time, not allocated ones hold only the fill
+    for (j = 1; j < world->height - 1; j++)
+        for (k = 0; k < world->chunks_x; k++)
+        {
+            c = world->chunks[(j >> CHUNK_BITS) * world->chunks_x + k];
+            if (c)
+                bits = SweepMatch(&c->tile[(j & CHUNK_MASK) << CHUNK_BITS],
+                    object);
+            else
+                bits = object == world->fill ? ~(uint32_t)0 : 0;
+
+            // Without the border columns
+            bits &= Columns(world, k);
+            if (k == 0)
+                bits &= ~(uint32_t)1;
+            if (k == (world->width - 1) >> CHUNK_BITS)
+                bits &= ~((uint32_t)1 << ((world->width - 1) & CHUNK_MASK));
+            if (bits)
+            {
+                if (y != 0)
+                    *y = j;
+                if (x != 0)
+                    *x = (k << CHUNK_BITS) + __builtin_ctz(bits);
+                return object; // Object found
+            }
+        }
+    return (-1); // Object not found
+}
+
+
+/**********************************
+ * This function moves the player *
+ **********************************/
+void MoveHero(struct world *world, int y, int x)
+{
+    int j, i, o;
+
+    if (FindObject(world, HERO, &j, &i) != HERO)
+        return;
+
+    // The border is METAL to the hero, even where a level has none there
+    o = Inside(world, j + y, i + x) ? GetBoard(world, j + y, i + x) : METAL;
+
+    if (RULE(collect, o)) // Get the diamond
+    {
+        if (world->game.diamonds)
+            world->game.diamonds--;
+        SoundRequest(world, SOUND_DIAMOND);
+    } else
+    if (RULE(pushable, o)) // Push the rock
+    {
+        if (x > 0)
+            if (GetBoard(world, j, i + x + 1) == TUNNEL)
+            {
+                SetBoard(world, j, i + x, TUNNEL);
+                SetBoard(world, j, i + x + 1, o);
+            }
+        if (x < 0)
+            if (GetBoard(world, j, i + x - 1) == TUNNEL)
+            {
+                SetBoard(world, j, i + x, TUNNEL);
+                SetBoard(world, j, i + x - 1, o);
+            }
+        o = GetBoard(world, j + y, i + x);
+    } else
+    if (RULE(explosive, o))
+    {
+        MakeCrash(world, Rules.crash[o], j + y, i + x);
+        return;
+    }
+
+    // Move player if it's possible, the door once all diamonds are in
+    if (!RULE(blocks, o) && (o != DOOR || !world->game.diamonds))
+    {
+        if (world->game.move_mode == REAL)
+        {
+            SetBoard(world, j, i, TUNNEL);
+            SetBoard(world, j + y, i + x, HERO);
+        } else
+        {
+            SetBoard(world, j + y, i + x, TUNNEL);
+        }
+        if (world->game.sound_to_play == SOUND_NONE)
+            SoundRequest(world, SOUND_MOVE);
+    }
+
+    world->game.move_mode = REAL;
+    world->game.move_time = world->game.time;
+    return;
+}
+
+
+/***************
+ * Kill player *
+ ***************/
+void KillHero(struct world *world)
+{
+    int y, x;
+
+    if (FindObject(world, HERO, &y, &x) == HERO)
+        MakeCrash(world, CRASH, y, x);
+}
+
+
+/************************************************
+ * Remember the player position or notice death *
+ ************************************************/
+void TrackHero(struct world *world)
+{
+    int y, x;
+
+    if (FindObject(world, HERO, &y, &x) < 0)
+    {
+        world->game.hero_state = KILLED;
+    } else
+    {
+        world->game.lastposx = x;
+        world->game.lastposy = y;
+    }
+}
+
+
+/*********************
+ * Time decrementing *
+ *********************/
+void DecrementTime(struct world *world)
+{
+    if (world->game.time <= 0 || world->game.hero_state == KILLED)
+        return;
+
+    switch (world->decrement_time--)
+    {
+        case 0:
+            world->game.time--;
+            world->decrement_time = INTER_TIME;
+        case INTER_TIME / 2:
+            if (world->game.hero_state == FACE1
+                && world->game.move_time - world->game.time > 5)
+                world->game.hero_state = FACE2;
+            else
+                world->game.hero_state = FACE1;
+    }
+}
+
+
+/*********************************************
+ * End of the level or end of the game check *
+ *********************************************/
+int CheckStatus(struct world *world)
+{
+    if (!world->game.time || world->game.hero_state == KILLED)
+    {
+        if (world->game.hero_state != KILLED)
+            KillHero(world);
+        return WORLD_GAME_OVER;
+    }
+
+    if (!world->game.diamonds && FindObject(world, DOOR, 0, 0) < 0)
+    {
+        StartLevel(world, ++world->game.current_level);
+        return WORLD_LEVEL_DONE;
+    }
+
+    return 0;
+}
+
+
+/******************************************************************
+ * Prepare the fresh world. Everything is cleared, nothing freed: *
+ * a world in use must go through WorldFree first                 *
+ ******************************************************************/
+void WorldInit(struct world *world)
+{
+    memset(world, 0, sizeof(*world));
+    world->game.current_level = 0;
+    world->game.diamonds      = 0;
+    world->game.move_mode     = REAL;
+    world->game.sound_mode    = 1;
+    world->game.sound_to_play = SOUND_NONE;
+    world->refresh_time       = 0;
+    world->decrement_time     = INTER_TIME;
+    WorldSeed(world, 0);
+}
+
+
+/*********************************
+ * Release the memory of a world *
+ *********************************/
+void WorldFree(struct world *world)
+{
+    int k;
+
+    BoardFree(world);
+    BitboardFree(world);
+    LevelCacheFree(world);
+    for (k = 0; k < ENTITY_KINDS; k++)
+        free(world->entities[k].pos);
+    free(world->moved.pos);
+    free(world->order.pos);
+    memset(world, 0, sizeof(*world));
+}
+
+
+/**************************************************
+ * Seed the world's random numbers (xoshiro128**) *
+ **************************************************/
+void WorldSeed(struct world *world, uint32_t seed)
+{
+    uint64_t z, s = seed;
+    int i;
+
+    // splitmix64 spreads the seed over the whole state, never all zero
+    for (i = 0; i < 4; i++)
+    {
+        z = (s += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        world->rng[i] = (uint32_t)((z ^ (z >> 31)) >> 32);
+    }
+}
+
+
+static uint32_t Rotl(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
+uint32_t WorldRandom(struct world *world)
+{
+    uint32_t *s = world->rng;
+    uint32_t result = Rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = Rotl(s[3], 11);
+
+    return result;
+}
+
+
+/******************************************************************
+ * New game from the given level and random seed. Only on a world *
+ * never set up or released by WorldFree, see WorldInit           *
+ ******************************************************************/
+void WorldStart(struct world *world, int level, uint32_t seed)
+{
+    WorldInit(world);
+    WorldSeed(world, seed);
+    world->game.current_level = level;
+    StartLevel(world, level);
+    TrackHero(world);
+}
+
+
+/*******************************************************************
+ * Whole state in one flat buffer: the counters, then the cells as *
+ * tile | flags bytes row by row. The derived data is rebuilt when *
+ * a state is loaded, so the buffer is all the future depends on.  *
+ *******************************************************************/
+struct state
+{
+    struct game game;
+    long tick;
+    int refresh_time, decrement_time;
+    uint32_t rng[4];
+    int width, height, fill;
+    uint64_t hash;
+    unsigned char cells[];
+};
+
+size_t StateSize(struct world *world)
+{
+    return sizeof(struct state) + (size_t)world->width * world->height;
+}
+
+void StateSave(struct world *world, void *buf)
+{
+    struct state *state = buf;
+    struct chunk *c;
+    unsigned char *p = state->cells;
+    int j, i, k;
+
+    state->game = world->game;
+    state->tick = world->tick;
+    state->refresh_time = world->refresh_time;
+    state->decrement_time = world->decrement_time;
+    memcpy(state->rng, world->rng, sizeof(state->rng));
+    state->width = world->width;
+    state->height = world->height;
+    state->fill = world->fill;
+    state->hash = world->hash;
+
+    for (j = 0; j < world->height; j++)
+        for (i = 0; i < world->width; i++)
+        {
+            c = Cell(world, j, i, &k);
+            *p++ = c ? c->tile[k] | c->flags[k] : world->fill;
+        }
+}
+
+void StateLoad(struct world *world, const void *buf)
+{
+    const struct state *state = buf;
+    const unsigned char *p = state->cells;
+    struct chunk *c;
+    int j, i, k;
+
+    // A board of the same size keeps its chunks, only the cells change
+    if (world->width != state->width || world->height != state->height
+        || world->fill != state->fill || !world->chunks)
+        BoardResize(world, state->width, state->height, state->fill);
+    else
+        world->generation++;
+    world->moved.count = 0;
+    world->order.count = 0;
+
+    for (j = 0; j < world->height; j++)
+        for (i = 0; i < world->width; i++, p++)
+        {
+            // Boxes and flies left MOVING are reset by the next MoveBoxes
+            if ((*p & FLAG_BOX_MOVE) && Inside(world, j, i))
+                EntityPush(&world->moved, j * world->width + i);
+
+            if (!(c = Cell(world, j, i, &k)))
+            {
+                if (*p == world->fill)
+                    continue;
+                c = NewCell(world, j, i, &k);
+            }
+            if ((c->tile[k] | c->flags[k]) != *p)
+            {
+                c->tile[k] = *p & 15;
+                c->flags[k] = *p & ~15;
+                c->changed = 1;
+            }
+        }
+    BoardSettle(world);
+    world->hash = state->hash;
+
+    world->game = state->game;
+    world->tick = state->tick;
+    world->refresh_time = state->refresh_time;
+    world->decrement_time = state->decrement_time;
+    memcpy(world->rng, state->rng, sizeof(world->rng));
+}
+
+
+
+/*******************************************************************
+ * Snapshots: the same state as StateSave, but chunk by chunk. A   *
+ * chunk no cell of which changed since the previous snapshot      *
+ * shares its page, so a snapshot every tick costs the counters    *
+ * and a page for each chunk where something happened.             *
+ *******************************************************************/
+static struct page *PageNew(struct chunk *c)
+{
+    struct page *page = malloc(sizeof(struct page));
+
+    if (!page)
+        exit(fprintf(stderr, "Out of memory\n"));
+    page->refs = 1;
+    memcpy(page->tile, c->tile, sizeof(page->tile));
+    memcpy(page->flags, c->flags, sizeof(page->flags));
+    return page;
+}
+
+// prev is the snapshot last taken or loaded on this world, or NULL;
+// returns the number of new pages
+int SnapshotTake(struct world *world, struct snapshot *snap,
+    const struct snapshot *prev)
+{
+    int n = world->chunks_x * world->chunks_y, k, pages = 0;
+    struct chunk *c;
+
+    snap->game = world->game;
+    snap->tick = world->tick;
+    snap->refresh_time = world->refresh_time;
+    snap->decrement_time = world->decrement_time;
+    memcpy(snap->rng, world->rng, sizeof(snap->rng));
+    snap->width = world->width;
+    snap->height = world->height;
+    snap->fill = world->fill;
+    snap->hash = world->hash;
+    if (!(snap->pages = calloc(n ? n : 1, sizeof(struct page *))))
+        exit(fprintf(stderr, "Out of memory\n"));
+
+    if (prev && (prev->width != world->width || prev->height != world->height
+        || prev->fill != world->fill))
+        prev = NULL;
+    for (k = 0; k < n; k++)
+    {
+        if (!(c = world->chunks[k]))
+            continue;
+        if (prev && prev->pages[k] && !c->changed)
+        {
+            snap->pages[k] = prev->pages[k];
+            snap->pages[k]->refs++;
+        } else
+        {
+            snap->pages[k] = PageNew(c);
+            pages++;
+        }
+        c->changed = 0;
+    }
+    return pages;
+}
+
+void SnapshotLoad(struct world *world, const struct snapshot *snap)
+{
+    const struct page *page;
+    struct chunk *c;
+    int n, k, j, i;
+
+    if (world->width != snap->width || world->height != snap->height
+        || world->fill != snap->fill || !world->chunks)
+        BoardResize(world, snap->width, snap->height, snap->fill);
+    else
+        world->generation++;
+    world->moved.count = 0;
+    world->order.count = 0;
+
+    n = world->chunks_x * world->chunks_y;
+    for (k = 0; k < n; k++)
+    {
+        c = world->chunks[k];
+        if (!(page = snap->pages[k]))
+        {
+            if (c)
+            {
+                // Its active cells leave the count of the band with it
+                for (j = 0; j < CHUNK_SIZE; j++)
+                    world->band_active[k / world->chunks_x] -=
+                        __builtin_popcount(c->active[j]);
+                free(c->slot);
+                free(c);
+                world->chunks[k] = NULL;
+            }
+            continue;
+        }
+
+        if (!c && !(c = world->chunks[k] = calloc(1, sizeof(struct chunk))))
+            exit(fprintf(stderr, "Out of memory\n"));
+        memcpy(c->tile, page->tile, sizeof(c->tile));
+        memcpy(c->flags, page->flags, sizeof(c->flags));
+        c->changed = 0;
+    }
+
+    // Boxes and flies left MOVING, in reading order as StateLoad does
+    for (j = 1; j < world->height - 1; j++)
+        for (i = 1; i < world->width - 1; i++)
+            if (GetFlags(world, j, i, FLAG_BOX_MOVE))
+                EntityPush(&world->moved, j * world->width + i);
+    BoardSettle(world);
+    world->hash = snap->hash;
+
+    world->game = snap->game;
+    world->tick = snap->tick;
+    world->refresh_time = snap->refresh_time;
+    world->decrement_time = snap->decrement_time;
+    memcpy(world->rng, snap->rng, sizeof(world->rng));
+}
+
+// Returns the number of pages freed, the others are still shared
+int SnapshotFree(struct snapshot *snap)
+{
+    int n = 0, k, chunks;
+
+    if (!snap->pages)
+        return 0;
+    chunks = ((snap->width + CHUNK_MASK) >> CHUNK_BITS)
+        * ((snap->height + CHUNK_MASK) >> CHUNK_BITS);
+    for (k = 0; k < chunks; k++)
+        if (snap->pages[k] && !--snap->pages[k]->refs)
+        {
+            free(snap->pages[k]);
+            n++;
+        }
+    free(snap->pages);
+    snap->pages = NULL;
+    return n;
+}
+
+
+/**************************************************
+ * FNV-1a over everything that decides the future *
+ **************************************************/
+static uint32_t Fnv(uint32_t h, uint32_t v)
+{
+    int i;
+
+    for (i = 0; i < 4; i++, v >>= 8)
+        h = (h ^ (v & 0xff)) * 16777619u;
+    return h;
+}
+
+uint32_t WorldChecksum(struct world *world)
+{
+    struct game *g = &world->game;
+    struct chunk *c;
+    uint32_t h = 2166136261u;
+    int j, i, k;
+
+    // Tile and flags in one byte, as the cells were always hashed
+    for (j = 0; j < world->height; j++)
+        for (i = 0; i < world->width; i++)
+        {
+            c = Cell(world, j, i, &k);
+            h = (h ^ (c ? c->tile[k] | c->flags[k] : world->fill))
+                * 16777619u;
+        }
+
+    h = Fnv(h, g->current_level);
+    h = Fnv(h, g->diamonds);
+    h = Fnv(h, g->time);
+    h = Fnv(h, g->hero_state);
+    h = Fnv(h, g->move_mode);
+    h = Fnv(h, g->lastposx);
+    h = Fnv(h, g->lastposy);
+    h = Fnv(h, g->move_time);
+    h = Fnv(h, world->refresh_time);
+    h = Fnv(h, world->decrement_time);
+    for (i = 0; i < 4; i++)
+        h = Fnv(h, world->rng[i]);
+
+    return h;
+}
+
+
+/************************************
+ * Handle a command from the player *
+ ************************************/
+void WorldInput(struct world *world, enum input input)
+{
+    switch (input)
+    {
+        case INPUT_LEFT:
+            MoveHero(world, 0, -1);
+            world->game.hero_state = LEFT;
+            break;
+        case INPUT_RIGHT:
+            MoveHero(world, 0, 1);
+            world->game.hero_state = RIGHT;
+            break;
+        case INPUT_UP:
+            MoveHero(world, -1, 0);
+            break;
+        case INPUT_DOWN:
+            MoveHero(world, 1, 0);
+            break;
+        case INPUT_ACTION:
+            if (world->game.hero_state == KILLED)
+                StartLevel(world, world->game.current_level);
+            else
+                world->game.move_mode = GHOST;
+            break;
+        case INPUT_MUTE:
+            world->game.sound_mode ^= 1;
+            break;
+        case INPUT_NEXT:
+            StartLevel(world, ++world->game.current_level);
+            break;
+        case INPUT_PREV:
+            if (world->game.current_level > 0)
+                StartLevel(world, --world->game.current_level);
+            break;
+        case INPUT_RESTART:
+            KillHero(world);
+            break;
+        case INPUT_RESPAWN: // Respawn cheat
+            SetBoard(world, world->game.lastposy, world->game.lastposx, HERO);
+            world->game.hero_state = FACE1;
+            break;
+        case INPUT_TIME: // Time cheat
+            world->game.time = world->game.level_time;
+            break;
+        case INPUT_NONE:
+            break;
+    }
+}
+
+
+/******************************************************************
+ * One tick of the game (the SDL frontend runs 60 ticks a second) *
+ ******************************************************************/
+int WorldStep(struct world *world, enum input input)
+{
+    int events = 0;
+
+    PROFILE_BEGIN(PHASE_STEP);
+    world->tick++;
+
+    if (input != INPUT_NONE)
+    {
+        PROFILE_BEGIN(PHASE_INPUT);
+        WorldInput(world, input);
+        TrackHero(world);
+        PROFILE_END(PHASE_INPUT);
+    }
+
+    DecrementTime(world);
+
+    if (!world->refresh_time--)
+    {
+        PROFILE_BEGIN(PHASE_CRASHES);
+        CrashRemove(world);
+        PROFILE_END(PHASE_CRASHES);
+        PROFILE_BEGIN(PHASE_ROCKS);
+        if (world->physics == PHYSICS_BITBOARD)
+            MoveRocksBitboard(world);
+        else
+        if (world->physics == PHYSICS_SCAN)
+            MoveRocksScan(world);
+        else
+            MoveRocks(world);
+        PROFILE_END(PHASE_ROCKS);
+        PROFILE_BEGIN(PHASE_BOXES);
+        MoveBoxes(world);
+        PROFILE_END(PHASE_BOXES);
+        events = WORLD_PHYSICS | CheckStatus(world);
+        TrackHero(world);
+        world->refresh_time = INTER_TIME / 5; // The speed of moving objects
+    }
+
+    PROFILE_END(PHASE_STEP);
+    return events;
+}
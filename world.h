@@ -0,0 +1,232 @@
+/*
+ * Boulder Palm
+ * Copyright (C) 2001-2020 by Wojciech Martusewicz <martusewicz@interia.pl>
+ */
+
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LEVELS_MAX          4096  // Largest width or height of a level
+#define LEVELS_CACHED       65536 // Levels above are read every time
+
+#define CHUNK_BITS          5
+#define CHUNK_SIZE          (1 << CHUNK_BITS)
+#define CHUNK_MASK          (CHUNK_SIZE - 1)
+
+#define INTER_TIME          60
+
+enum tile {TUNNEL, WALL, HERO, ROCK, DIAMOND, GROUND, METAL, BOX, DOOR, FLY,
+           CRASH};
+enum hero {KILLED, FACE1, FACE2, RIGHT, LEFT};
+enum sound {SOUND_NONE, SOUND_MOVE, SOUND_DIAMOND, SOUND_EXPLOSION};
+enum direction {NORTH, EAST, SOUTH, WEST};
+enum move {REAL, GHOST};
+enum box_state {STILL, MOVING};
+enum side {FALL_LEFT = -1, FALL_RIGHT = 1};
+
+// Player commands, one per tick at most
+enum input {INPUT_NONE, INPUT_LEFT, INPUT_RIGHT, INPUT_UP, INPUT_DOWN,
+            INPUT_ACTION, INPUT_MUTE, INPUT_NEXT, INPUT_PREV, INPUT_RESTART,
+            INPUT_RESPAWN, INPUT_TIME};
+
+// Engines for rocks and diamonds, see WorldStep. PHYSICS_SCAN sweeps the
+// whole board (MoveRocksScan), the reference the active set must match.
+enum physics {PHYSICS_SCALAR, PHYSICS_BITBOARD, PHYSICS_SCAN};
+
+// What happened during the tick (bits returned by WorldStep)
+enum world_event {WORLD_PHYSICS = 1, WORLD_GAME_OVER = 2, WORLD_LEVEL_DONE = 4};
+
+struct game
+{
+    int current_level;
+    int level_diamonds;   // Total number of diamonds to pick up
+    int level_time;       // Total time to pass the board
+    int diamonds;         // Diamonds left
+    int time;             // Time left
+    enum hero hero_state; // Direction of player
+    enum move move_mode;  // Move mode (real move or action without move)
+    int lastposx, lastposy;
+    int move_time;        // Time of last move (impatience feature)
+    int sound_mode;
+    enum sound sound_to_play;
+};
+
+// Kinds of tiles kept in the entity registry
+enum entity {ENTITY_HERO, ENTITY_DOOR, ENTITY_BOX, ENTITY_FLY, ENTITY_KINDS};
+
+// Positions (h * width + w) of one kind inside the border
+struct entities
+{
+    int count, alloc;
+    int *pos;
+};
+
+// Bits of a cell in the flags plane
+#define FLAG_ROCK_MOVE      0x10
+#define FLAG_BOX_MOVE       0x20
+#define FLAG_BOX_DIR        0xc0
+#define FLAG_BOX_DIR_SHIFT  6
+
+/*
+ * CHUNK_SIZE x CHUNK_SIZE piece of the board. Chunks are allocated on the
+ * first change, until then all their cells read as the level's fill tile.
+ */
+struct chunk
+{
+    // Planes of CHUNK_SIZE rows by CHUNK_SIZE cells
+    unsigned char tile[CHUNK_SIZE * CHUNK_SIZE]; // enum tile
+    unsigned char flags[CHUNK_SIZE * CHUNK_SIZE]; // FLAG_ bits
+    // Rocks and diamonds that may move on the next MoveRocks (one bit each)
+    uint32_t active[CHUNK_SIZE];
+    int crashes;          // CRASH tiles to be removed
+    int changed;          // Cells changed since the last SnapshotTake
+    int *slot;            // Index of each entity in its list, on demand
+};
+
+// Tile and flags planes of a chunk at some tick, shared by snapshots
+struct page
+{
+    int refs;
+    unsigned char tile[CHUNK_SIZE * CHUNK_SIZE];
+    unsigned char flags[CHUNK_SIZE * CHUNK_SIZE];
+};
+
+// The whole state at one tick; unchanged chunks share the page
+struct snapshot
+{
+    struct game game;
+    long tick;
+    int refresh_time, decrement_time;
+    uint32_t rng[4];
+    int width, height, fill;
+    uint64_t hash;
+    struct page **pages;  // chunks_x * chunks_y, NULL where no chunk
+};
+
+// Planes of the bitboard engine: one per tile, then the rocks marked MOVING,
+// then the tiles with each rule MoveRocksBitboard needs (see rules.h)
+#define BITBOARD_WIDTH      64    // Wider boards take the scalar engine
+#define BITBOARD_MOVING     16
+#define BITBOARD_FALLS      17
+#define BITBOARD_SOLID      18
+#define BITBOARD_EXPLOSIVE  19
+#define BITBOARD_PLANES     20
+
+/*
+ * The board as bitboards, one 64 bit word per row and plane (bit w for
+ * cell w). Built by MoveRocksBitboard, then kept by SetBoard.
+ */
+struct bitboard
+{
+    int generation;       // Board it was built for, see BoardResize
+    int height;
+    uint64_t (*rows)[BITBOARD_PLANES];
+};
+
+// Board of a level as it was loaded, see StartLevel
+struct level_copy
+{
+    int state;            // 0 not read yet, 1 kept here, -1 missing
+    int width, height, fill;
+    int diamonds, time;
+    uint64_t hash;
+    struct chunk **chunks; // Allocated chunks only, without slots
+    int *band_active;
+    struct entities entities[ENTITY_KINDS];
+};
+
+/*
+ * Complete state of one game. Nothing here depends on SDL, so any number
+ * of worlds can live (and be stepped) in one process.
+ */
+struct world
+{
+    struct game game;
+    long tick;            // Ticks since WorldInit
+    int refresh_time;     // Ticks left to the next physics update
+    int decrement_time;   // Ticks left to the next second of game time
+    uint32_t rng[4];      // xoshiro128** state, see WorldSeed
+    int width, height;    // Size of the current level
+    int chunks_x, chunks_y;
+    struct chunk **chunks; // chunks_x * chunks_y, NULL until used
+    int fill;             // Tile of the cells not given by the level
+    int generation;       // Counts new boards, see BoardResize
+    uint64_t hash;        // Zobrist hash of the cells, see BoardHash
+    int *band_active;     // Active cells in each row of chunks
+    // Where the heroes, doors, boxes and flies are, kept by SetBoard
+    struct entities entities[ENTITY_KINDS];
+    struct entities moved; // Boxes and flies marked MOVING last time
+    struct entities order; // MoveBoxes work list
+    struct level_copy *levels; // Levels started so far, by number
+    int levels_alloc;
+    enum physics physics; // PHYSICS_SCALAR unless set after WorldStart
+    struct bitboard bitboard;
+    unsigned sounds;      // 1 << SOUND_ of every sound requested, until
+                          // the frontend takes them
+};
+
+/* Access (get/set) to game board properties */
+int GetBoard(struct world *world, int h, int w);
+void SetBoard(struct world *world, int h, int w, int v);
+int GetRockMove(struct world *world, int h, int w);
+void SetRockMove(struct world *world, int h, int w, int v);
+int GetBoxMove(struct world *world, int h, int w);
+void SetBoxMove(struct world *world, int h, int w, int v);
+int GetBoxDir(struct world *world, int h, int w);
+void SetBoxDir(struct world *world, int h, int w, int v);
+
+/* Board storage */
+int BoardResize(struct world *world, int width, int height, int fill);
+void BoardFree(struct world *world);
+const unsigned char *BoardSpan(struct world *world, int h, int w, int *n);
+const unsigned char *FlagsSpan(struct world *world, int h, int w, int *n);
+void BoardPut(struct world *world, int h, int w, int v);
+void BoardSettle(struct world *world);
+uint64_t BoardHash(struct world *world);
+uint64_t BoardHashFull(struct world *world);
+
+/* Levels */
+int LoadLevelStream(struct world *world, FILE *fp);
+int LoadLevelFile(struct world *world, const char *path);
+int LoadLevel(struct world *world, int level);
+void StartLevel(struct world *world, int new_level);
+
+/* Game rules */
+void SoundRequest(struct world *world, int sound);
+void MakeCrash(struct world *world, int object, int y, int x);
+void CrashRemove(struct world *world);
+void MoveBoxes(struct world *world);
+void MoveRock(struct world *world, int j, int i);
+void MoveRocks(struct world *world);
+void MoveRocksScan(struct world *world);
+void WakeAll(struct world *world);
+void RebuildEntities(struct world *world);
+int FindObject(struct world *world, int object, int *y, int *x);
+void MoveHero(struct world *world, int y, int x);
+void KillHero(struct world *world);
+void TrackHero(struct world *world);
+void DecrementTime(struct world *world);
+int CheckStatus(struct world *world);
+
+/* Whole game */
+void WorldInit(struct world *world);
+void WorldFree(struct world *world);
+void WorldSeed(struct world *world, uint32_t seed);
+uint32_t WorldRandom(struct world *world);
+void WorldStart(struct world *world, int level, uint32_t seed);
+uint32_t WorldChecksum(struct world *world);
+int SnapshotTake(struct world *world, struct snapshot *snap,
+    const struct snapshot *prev);
+void SnapshotLoad(struct world *world, const struct snapshot *snap);
+int SnapshotFree(struct snapshot *snap);
+size_t StateSize(struct world *world);
+void StateSave(struct world *world, void *buf);
+void StateLoad(struct world *world, const void *buf);
+void WorldInput(struct world *world, enum input input);
+int WorldStep(struct world *world, enum input input);
+
+#endif